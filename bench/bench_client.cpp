@@ -0,0 +1,238 @@
+// In-memory benchmark for the websocketpp message path.
+//
+// A client connection and a server connection, both using the iostream
+// transport, are wired to each other through in-memory buffers. No sockets
+// are involved, so the numbers reflect only framing, masking, UTF-8
+// validation, and message buffer handling in connection_impl.hpp and
+// hybi13.hpp.
+//
+// Messages sent by the client are masked; messages sent by the server are not.
+// Text messages are UTF-8 validated by the receiver; binary messages are not.
+// Only allocations made by the client connection are counted: in its send()
+// for the send cases, and in its reads for the receive cases. The server end
+// and the buffers that carry bytes between the two are left out.
+// The protocol requires both (a server must reject unmasked frames, and a
+// receiver must validate text), so --mask picks the direction and --utf8 picks
+// the message type. The two are independent, so any of the four combinations
+// can be run on its own.
+
+#include "bench_common.h"
+
+#include <websocketpp/config/core.hpp>
+#include <websocketpp/config/core_client.hpp>
+#include <websocketpp/client.hpp>
+#include <websocketpp/server.hpp>
+
+namespace bench_config {
+
+// Large enough for the 64 MB case.
+static const size_t max_message_size = 128 * 1024 * 1024;
+
+struct client : public bench_message_config<ws_websocketpp::config::core_client> {
+  static const size_t max_message_size = bench_config::max_message_size;
+};
+
+struct server : public bench_message_config<ws_websocketpp::config::core> {
+  static const size_t max_message_size = bench_config::max_message_size;
+};
+
+} // namespace bench_config
+
+typedef ws_websocketpp::client<bench_config::client> client_type;
+typedef ws_websocketpp::server<bench_config::server> server_type;
+typedef ws_websocketpp::frame::opcode::value opcode;
+
+using ws_websocketpp::lib::placeholders::_1;
+using ws_websocketpp::lib::placeholders::_2;
+using ws_websocketpp::lib::placeholders::_3;
+using ws_websocketpp::lib::bind;
+
+// Holds both ends of an in-memory connection. Bytes written by one side are
+// queued and delivered to the other side by pump().
+class Pipe {
+public:
+  Pipe(const BenchOptions& opts) : clientReceived(0), serverReceived(0), receivedBytes(0) {
+    client.clear_access_channels(ws_websocketpp::log::alevel::all);
+    client.clear_error_channels(ws_websocketpp::log::elevel::all);
+    server.clear_access_channels(ws_websocketpp::log::alevel::all);
+    server.clear_error_channels(ws_websocketpp::log::elevel::all);
+
+    client.set_message_handler(bind(&Pipe::onClientMessage, this, _2));
+    server.set_message_handler(bind(&Pipe::onServerMessage, this, _2));
+
+    ws_websocketpp::lib::error_code ec;
+    clientCon = client.get_connection("ws://localhost/", ec);
+    if (ec) {
+      std::fprintf(stderr, "get_connection failed: %s\n", ec.message().c_str());
+      std::exit(1);
+    }
+    clientCon->set_write_handler(bind(&Pipe::write, this, &toServer, _2, _3));
+    clientCon->set_vector_write_handler(bind(&Pipe::writeVector, this, &toServer, _2));
+
+    serverCon = server.get_connection();
+    serverCon->set_write_handler(bind(&Pipe::write, this, &toClient, _2, _3));
+    serverCon->set_vector_write_handler(bind(&Pipe::writeVector, this, &toClient, _2));
+
+    // There are no timers in the iostream transport, so only the limits apply.
+    clientCon->set_write_coalescing(opts.writeMaxBytes, opts.writeMaxFrames, opts.writeFlushDelay);
+    serverCon->set_write_coalescing(opts.writeMaxBytes, opts.writeMaxFrames, opts.writeFlushDelay);
+
+    client.connect(clientCon);
+    serverCon->start();
+    pump();
+
+    if (clientCon->get_state() != ws_websocketpp::session::state::open ||
+        serverCon->get_state() != ws_websocketpp::session::state::open)
+    {
+      std::fprintf(stderr, "Handshake failed\n");
+      std::exit(1);
+    }
+  }
+
+  // Deliver queued bytes in both directions until neither side has anything
+  // more to say. Allocations are counted only on the client's side.
+  void pump() {
+    while (!toServer.empty() || !toClient.empty()) {
+      {
+        BenchCountScope uncounted(false);
+        deliver(toServer, serverCon);
+      }
+      deliver(toClient, clientCon);
+    }
+  }
+
+  client_type client;
+  server_type server;
+  client_type::connection_ptr clientCon;
+  server_type::connection_ptr serverCon;
+
+  size_t clientReceived;
+  size_t serverReceived;
+  size_t receivedBytes;
+
+private:
+  ws_websocketpp::lib::error_code write(std::string* out, char const* buf, size_t len) {
+    BenchCountScope uncounted(false);
+    out->append(buf, len);
+    return ws_websocketpp::lib::error_code();
+  }
+
+  ws_websocketpp::lib::error_code writeVector(
+    std::string* out,
+    std::vector<ws_websocketpp::transport::buffer> const& bufs)
+  {
+    BenchCountScope uncounted(false);
+    for (size_t i = 0; i < bufs.size(); i++) {
+      out->append(bufs[i].buf, bufs[i].len);
+    }
+    return ws_websocketpp::lib::error_code();
+  }
+
+  template <typename ConPtr>
+  void deliver(std::string& queue, ConPtr con) {
+    if (queue.empty()) {
+      return;
+    }
+    // The receiving side may write in response (e.g. the handshake), which
+    // appends to the other queue, so it's safe to swap this one out first.
+    inbound.clear();
+    inbound.swap(queue);
+    size_t consumed = con->read_all(inbound.data(), inbound.size());
+    if (consumed != inbound.size()) {
+      std::fprintf(stderr, "Connection stopped reading after %zu of %zu bytes\n",
+        consumed, inbound.size());
+      std::exit(1);
+    }
+  }
+
+  void onClientMessage(client_type::message_ptr msg) {
+    clientReceived++;
+    receivedBytes += msg->get_payload().size();
+  }
+
+  void onServerMessage(server_type::message_ptr msg) {
+    serverReceived++;
+    receivedBytes += msg->get_payload().size();
+  }
+
+  std::string toServer;
+  std::string toClient;
+  std::string inbound;
+};
+
+// Send `iterations` messages from `sender`. The send() call is counted only
+// when the client is the sender; pump() counts the client's reads.
+template <typename ConPtr>
+BenchResult run(Pipe& pipe, ConPtr sender, bool clientSends, size_t& received,
+                const std::string& payload, opcode op, size_t iterations)
+{
+  // One untimed message to warm up the connections' buffers.
+  sender->send(payload.data(), payload.size(), op);
+  pipe.pump();
+
+  size_t receivedBefore = received;
+  size_t bytesBefore = pipe.receivedBytes;
+  uint64_t allocsBefore = allocCount();
+  BenchClock::time_point start = BenchClock::now();
+
+  for (size_t i = 0; i < iterations; i++) {
+    ws_websocketpp::lib::error_code ec;
+    {
+      BenchCountScope counted(clientSends);
+      ec = sender->send(payload.data(), payload.size(), op);
+    }
+    if (ec) {
+      std::fprintf(stderr, "send failed: %s\n", ec.message().c_str());
+      std::exit(1);
+    }
+    pipe.pump();
+  }
+
+  BenchResult r;
+  r.seconds = secondsSince(start);
+  r.allocs = allocCount() - allocsBefore;
+  r.messages = received - receivedBefore;
+  r.bytes = pipe.receivedBytes - bytesBefore;
+
+  if (r.messages != iterations) {
+    std::fprintf(stderr, "Expected %zu messages, received %zu\n", iterations, r.messages);
+    std::exit(1);
+  }
+  return r;
+}
+
+int main(int argc, char** argv) {
+  BenchOptions opts = parseOptions(argc, argv);
+  std::vector<size_t> sizes = messageSizes(opts);
+
+  Pipe pipe(opts);
+
+  printHeader("direction");
+  for (int masked = 1; masked >= 0; masked--) {
+    if (!selected(opts.mask, masked)) {
+      continue;
+    }
+    for (size_t k = 0; k < sizeof(payloadKinds) / sizeof(payloadKinds[0]); k++) {
+      PayloadKind kind = payloadKinds[k];
+      if (!selected(opts.utf8, isText(kind))) {
+        continue;
+      }
+      opcode op = isText(kind) ? ws_websocketpp::frame::opcode::text
+                               : ws_websocketpp::frame::opcode::binary;
+      for (size_t i = 0; i < sizes.size(); i++) {
+        std::string payload = makePayload(sizes[i], kind);
+        size_t iterations = iterationsFor(opts, sizes[i]);
+        BenchResult r;
+        if (masked) {
+          r = run(pipe, pipe.clientCon, true, pipe.serverReceived, payload, op, iterations);
+          printResult("send", kind, true, sizes[i], r);
+        } else {
+          r = run(pipe, pipe.serverCon, false, pipe.clientReceived, payload, op, iterations);
+          printResult("receive", kind, false, sizes[i], r);
+        }
+      }
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,386 @@
+#ifndef BENCH_COMMON_H
+#define BENCH_COMMON_H
+
+// Shared helpers for the benchmarks in this directory. These programs are not
+// part of the R package; see README.md for how to build and run them.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+
+// The vendored websocketpp loggers write through WrappedOstream.
+#include "wrapped_print.h"
+
+#include <websocketpp/message_buffer/message.hpp>
+#include <websocketpp/message_buffer/alloc.hpp>
+#include "message_pool.h"
+
+// ---------------------------------------------------------------------------
+// Allocation counting
+//
+// Calls to the global operator new are counted while benchCounting is true,
+// which it is unless a BenchCountScope turns it off. Including this header in
+// more than one translation unit would define these twice, so each benchmark
+// is a single .cpp file.
+// ---------------------------------------------------------------------------
+static std::atomic<uint64_t> benchAllocCount(0);
+static std::atomic<bool> benchCounting(true);
+
+// Turns allocation counting on or off until the end of the scope, so that a
+// benchmark can leave its own bookkeeping out of the count.
+class BenchCountScope {
+public:
+  explicit BenchCountScope(bool counting)
+    : previous(benchCounting.exchange(counting, std::memory_order_relaxed)) {}
+  ~BenchCountScope() {
+    benchCounting.store(previous, std::memory_order_relaxed);
+  }
+
+private:
+  bool previous;
+};
+
+// All of the replacements below allocate and free through these two
+// functions, so that every form of new is matched by every form of delete.
+// They aren't inlined, so that the compiler doesn't pair a new expression
+// with the free() call (-Wmismatched-new-delete).
+#if defined(__GNUC__)
+#define BENCH_NOINLINE __attribute__((noinline))
+#else
+#define BENCH_NOINLINE
+#endif
+
+BENCH_NOINLINE static void* benchAlloc(std::size_t size, std::size_t align) {
+  if (benchCounting.load(std::memory_order_relaxed)) {
+    benchAllocCount.fetch_add(1, std::memory_order_relaxed);
+  }
+  if (size == 0) {
+    size = 1;
+  }
+  void* p;
+  if (align <= alignof(std::max_align_t)) {
+    p = std::malloc(size);
+  } else if (posix_memalign(&p, align, size) != 0) {
+    p = NULL;
+  }
+  return p;
+}
+
+BENCH_NOINLINE static void benchFree(void* p) {
+  std::free(p);
+}
+
+static void* benchAllocOrThrow(std::size_t size, std::size_t align) {
+  void* p = benchAlloc(size, align);
+  if (p == NULL) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void* operator new(std::size_t size) {
+  return benchAllocOrThrow(size, 0);
+}
+void* operator new[](std::size_t size) {
+  return benchAllocOrThrow(size, 0);
+}
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+  return benchAlloc(size, 0);
+}
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+  return benchAlloc(size, 0);
+}
+
+void operator delete(void* p) noexcept {
+  benchFree(p);
+}
+void operator delete[](void* p) noexcept {
+  benchFree(p);
+}
+void operator delete(void* p, const std::nothrow_t&) noexcept {
+  benchFree(p);
+}
+void operator delete[](void* p, const std::nothrow_t&) noexcept {
+  benchFree(p);
+}
+void operator delete(void* p, std::size_t) noexcept {
+  benchFree(p);
+}
+void operator delete[](void* p, std::size_t) noexcept {
+  benchFree(p);
+}
+
+#ifdef __cpp_aligned_new
+void* operator new(std::size_t size, std::align_val_t align) {
+  return benchAllocOrThrow(size, static_cast<std::size_t>(align));
+}
+void* operator new[](std::size_t size, std::align_val_t align) {
+  return benchAllocOrThrow(size, static_cast<std::size_t>(align));
+}
+void* operator new(std::size_t size, std::align_val_t align, const std::nothrow_t&) noexcept {
+  return benchAlloc(size, static_cast<std::size_t>(align));
+}
+void* operator new[](std::size_t size, std::align_val_t align, const std::nothrow_t&) noexcept {
+  return benchAlloc(size, static_cast<std::size_t>(align));
+}
+void operator delete(void* p, std::align_val_t) noexcept {
+  benchFree(p);
+}
+void operator delete[](void* p, std::align_val_t) noexcept {
+  benchFree(p);
+}
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept {
+  benchFree(p);
+}
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept {
+  benchFree(p);
+}
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept {
+  benchFree(p);
+}
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept {
+  benchFree(p);
+}
+#endif
+
+inline uint64_t allocCount() {
+  return benchAllocCount.load(std::memory_order_relaxed);
+}
+
+// ---------------------------------------------------------------------------
+// Message buffers
+//
+// Like the package's client configs, the benchmarks get message buffers from
+// the shared pool. Build with -DBENCH_ALLOC_MESSAGES to compare against
+// websocketpp's default manager, which allocates a new message every time.
+// ---------------------------------------------------------------------------
+template <typename base>
+struct bench_message_config : public base {
+#ifdef BENCH_ALLOC_MESSAGES
+  typedef ws_websocketpp::message_buffer::message
+    <ws_websocketpp::message_buffer::alloc::con_msg_manager> message_type;
+  typedef ws_websocketpp::message_buffer::alloc::con_msg_manager
+    <message_type> con_msg_manager_type;
+  typedef ws_websocketpp::message_buffer::alloc::endpoint_msg_manager
+    <con_msg_manager_type> endpoint_msg_manager_type;
+#else
+  typedef ws_websocketpp::message_buffer::message
+    <message_pool::ConMsgManager> message_type;
+  typedef message_pool::ConMsgManager<message_type> con_msg_manager_type;
+  typedef message_pool::EndpointMsgManager<con_msg_manager_type> endpoint_msg_manager_type;
+#endif
+};
+
+// ---------------------------------------------------------------------------
+// Options and reporting
+// ---------------------------------------------------------------------------
+
+struct BenchOptions {
+  size_t minSize;
+  size_t maxSize;
+  // Approximate number of payload bytes to push through each case. Small
+  // messages are additionally capped at maxMessages.
+  double targetBytes;
+  size_t maxMessages;
+  // Write coalescing settings for the sending connection; see
+  // connection::set_write_coalescing(). All zero means the defaults.
+  size_t writeMaxBytes;
+  size_t writeMaxFrames;
+  long writeFlushDelay;
+  // Which cases to run with masking and with UTF-8 validation: BENCH_ON,
+  // BENCH_OFF, or BENCH_BOTH. See selected().
+  int mask;
+  int utf8;
+};
+
+enum { BENCH_OFF = 0, BENCH_ON = 1, BENCH_BOTH = 2 };
+
+// Parses the value of an on|off|both option.
+inline int parseToggle(const char* name, const char* value) {
+  std::string v(value);
+  if (v == "on") return BENCH_ON;
+  if (v == "off") return BENCH_OFF;
+  if (v == "both") return BENCH_BOTH;
+  std::fprintf(stderr, "%s takes on, off, or both\n", name);
+  std::exit(1);
+}
+
+// Whether a case with the feature turned on (or off) should run.
+inline bool selected(int toggle, bool on) {
+  return toggle == BENCH_BOTH || toggle == (on ? BENCH_ON : BENCH_OFF);
+}
+
+inline BenchOptions parseOptions(int argc, char** argv) {
+  BenchOptions opts;
+  opts.minSize = 16;
+  opts.maxSize = 64 * 1024 * 1024;
+  opts.targetBytes = 512.0 * 1024 * 1024;
+  opts.maxMessages = 200000;
+  opts.writeMaxBytes = 0;
+  opts.writeMaxFrames = 0;
+  opts.writeFlushDelay = 0;
+  opts.mask = BENCH_BOTH;
+  opts.utf8 = BENCH_BOTH;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg(argv[i]);
+    if (arg == "--quick") {
+      opts.maxSize = 1024 * 1024;
+      opts.targetBytes = 16.0 * 1024 * 1024;
+      opts.maxMessages = 20000;
+    } else if (arg.compare(0, 11, "--max-size=") == 0) {
+      opts.maxSize = std::strtoull(arg.c_str() + 11, NULL, 10);
+    } else if (arg.compare(0, 11, "--min-size=") == 0) {
+      opts.minSize = std::strtoull(arg.c_str() + 11, NULL, 10);
+    } else if (arg.compare(0, 11, "--coalesce=") == 0) {
+      unsigned long long bytes, frames;
+      long delay;
+      if (std::sscanf(arg.c_str() + 11, "%llu,%llu,%ld", &bytes, &frames, &delay) != 3) {
+        std::fprintf(stderr, "--coalesce takes MAX_BYTES,MAX_FRAMES,DELAY_US\n");
+        std::exit(1);
+      }
+      opts.writeMaxBytes = bytes;
+      opts.writeMaxFrames = frames;
+      opts.writeFlushDelay = delay;
+    } else if (arg.compare(0, 7, "--mask=") == 0) {
+      opts.mask = parseToggle("--mask", arg.c_str() + 7);
+    } else if (arg.compare(0, 7, "--utf8=") == 0) {
+      opts.utf8 = parseToggle("--utf8", arg.c_str() + 7);
+    } else {
+      std::fprintf(stderr,
+        "Usage: %s [--quick] [--min-size=BYTES] [--max-size=BYTES]\n"
+        "          [--coalesce=MAX_BYTES,MAX_FRAMES,DELAY_US]\n"
+        "          [--mask=on|off|both] [--utf8=on|off|both]\n", argv[0]);
+      std::exit(1);
+    }
+  }
+  return opts;
+}
+
+// Message sizes from 16 B up to 64 MB, in steps of 4x.
+inline std::vector<size_t> messageSizes(const BenchOptions& opts) {
+  std::vector<size_t> sizes;
+  for (size_t s = 16; s <= 64 * 1024 * 1024; s *= 4) {
+    if (s >= opts.minSize && s <= opts.maxSize) {
+      sizes.push_back(s);
+    }
+  }
+  return sizes;
+}
+
+inline size_t iterationsFor(const BenchOptions& opts, size_t size) {
+  double n = opts.targetBytes / size;
+  if (n > opts.maxMessages) n = opts.maxMessages;
+  if (n < 4) n = 4;
+  return static_cast<size_t>(n);
+}
+
+// The kinds of payload that are measured. UTF-8 text mixes ASCII with two-
+// and three-byte sequences (about one multibyte character in every 32 bytes),
+// so the validator's slow path runs on every block. ASCII text is JSON-like,
+// as many feeds are, and never leaves the validator's ASCII fast path. Binary
+// payloads are random bytes and aren't validated.
+enum PayloadKind { PAYLOAD_UTF8, PAYLOAD_ASCII, PAYLOAD_BINARY };
+static const PayloadKind payloadKinds[] = { PAYLOAD_UTF8, PAYLOAD_ASCII, PAYLOAD_BINARY };
+
+inline bool isText(PayloadKind kind) {
+  return kind != PAYLOAD_BINARY;
+}
+
+inline const char* payloadName(PayloadKind kind) {
+  switch (kind) {
+  case PAYLOAD_UTF8: return "utf8";
+  case PAYLOAD_ASCII: return "ascii";
+  case PAYLOAD_BINARY: return "binary";
+  }
+  return "";
+}
+
+inline std::string makePayload(size_t size, PayloadKind kind) {
+  std::string s;
+  s.reserve(size);
+  if (kind == PAYLOAD_BINARY) {
+    uint32_t x = 2463534242u;
+    while (s.size() < size) {
+      x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+      s.push_back(static_cast<char>(x & 0xFF));
+    }
+    return s;
+  }
+
+  if (kind == PAYLOAD_ASCII) {
+    char record[96];
+    for (unsigned i = 0; s.size() < size; i++) {
+      int n = std::snprintf(record, sizeof(record),
+        "{\"sym\":\"S%04u\",\"px\":%u.%02u,\"qty\":%u,\"side\":\"%s\"},",
+        i % 10000, 100 + i % 900, i % 100, 1 + i % 500, i % 2 ? "buy" : "sell");
+      s.append(record, std::min<size_t>(n, size - s.size()));
+    }
+    return s;
+  }
+
+  static const char* pieces[] = { "\xC3\xA9", "\xE2\x82\xAC" };
+  size_t k = 0;
+  while (s.size() < size) {
+    if (s.size() % 32 == 31 && s.size() + 3 <= size) {
+      s.append(pieces[k++ % 2]);
+    } else {
+      s.push_back(static_cast<char>('a' + s.size() % 26));
+    }
+  }
+  return s;
+}
+
+inline std::string formatBytes(double bytes) {
+  static const char* units[] = { "B", "KB", "MB", "GB" };
+  int u = 0;
+  while (bytes >= 1024 && u < 3) {
+    bytes /= 1024;
+    u++;
+  }
+  char buf[32];
+  std::snprintf(buf, sizeof(buf), u == 0 ? "%.0f %s" : "%.1f %s", bytes, units[u]);
+  return buf;
+}
+
+struct BenchResult {
+  size_t messages;
+  size_t bytes;
+  double seconds;
+  uint64_t allocs;
+};
+
+inline void printHeader(const char* firstColumn) {
+  std::printf("%-10s %-6s %5s %5s %10s %12s %12s %12s\n",
+    firstColumn, "type", "mask", "utf8", "size", "msgs/sec", "bytes/sec",
+    "allocs/msg");
+}
+
+inline void printResult(const char* label, PayloadKind kind, bool masked,
+                        size_t size, const BenchResult& r)
+{
+  std::printf("%-10s %-6s %5s %5s %10s %12.0f %10s/s %12.2f\n",
+    label,
+    payloadName(kind),
+    masked ? "on" : "off",
+    isText(kind) ? "on" : "off",
+    formatBytes(size).c_str(),
+    r.messages / r.seconds,
+    formatBytes(r.bytes / r.seconds).c_str(),
+    static_cast<double>(r.allocs) / r.messages);
+  std::fflush(stdout);
+}
+
+typedef std::chrono::steady_clock BenchClock;
+
+inline double secondsSince(BenchClock::time_point start) {
+  return std::chrono::duration<double>(BenchClock::now() - start).count();
+}
+
+#endif
@@ -0,0 +1,213 @@
+// Loopback TCP benchmark for the websocketpp message path.
+//
+// A websocketpp echo server and client are run on 127.0.0.1, sharing a single
+// io_service on the main thread. For each case the client keeps a fixed number
+// of messages in flight and sends a new one each time an echo comes back.
+//
+// Messages from the client are masked and messages from the server are not,
+// so each round trip exercises both. Text messages are UTF-8 validated on both
+// ends. bytes/sec counts payload bytes in one direction, and allocs/msg counts
+// allocations on both ends of the connection. Since every round trip has one
+// masked and one unmasked message, --mask doesn't apply here; --utf8 picks the
+// message type.
+
+#include "bench_common.h"
+
+#include <websocketpp/config/asio_no_tls.hpp>
+#include <websocketpp/config/asio_no_tls_client.hpp>
+#include <websocketpp/client.hpp>
+#include <websocketpp/server.hpp>
+
+namespace bench_config {
+
+// Large enough for the 64 MB case.
+static const size_t max_message_size = 128 * 1024 * 1024;
+
+struct client : public bench_message_config<ws_websocketpp::config::asio_client> {
+  static const size_t max_message_size = bench_config::max_message_size;
+};
+
+struct server : public bench_message_config<ws_websocketpp::config::asio> {
+  static const size_t max_message_size = bench_config::max_message_size;
+};
+
+} // namespace bench_config
+
+typedef ws_websocketpp::client<bench_config::client> client_type;
+typedef ws_websocketpp::server<bench_config::server> server_type;
+typedef ws_websocketpp::frame::opcode::value opcode;
+
+using ws_websocketpp::lib::placeholders::_1;
+using ws_websocketpp::lib::placeholders::_2;
+using ws_websocketpp::lib::bind;
+
+// Number of messages the client keeps in flight.
+static const size_t window = 8;
+
+class Loopback {
+public:
+  Loopback(const BenchOptions& opts) : opts(opts), open(false), payload(NULL),
+    remaining(0), outstanding(0), received(0), receivedBytes(0)
+  {
+    server.clear_access_channels(ws_websocketpp::log::alevel::all);
+    server.clear_error_channels(ws_websocketpp::log::elevel::all);
+    server.init_asio(&ios);
+    server.set_reuse_addr(true);
+    server.set_open_handler(bind(&Loopback::onServerOpen, this, _1));
+    server.set_message_handler(bind(&Loopback::onServerMessage, this, _1, _2));
+
+    client.clear_access_channels(ws_websocketpp::log::alevel::all);
+    client.clear_error_channels(ws_websocketpp::log::elevel::all);
+    client.init_asio(&ios);
+    client.set_open_handler(bind(&Loopback::onClientOpen, this, _1));
+    client.set_fail_handler(bind(&Loopback::onClientFail, this, _1));
+    client.set_message_handler(bind(&Loopback::onClientMessage, this, _1, _2));
+
+    ws_websocketpp::lib::asio::ip::tcp::endpoint ep(
+      ws_websocketpp::lib::asio::ip::address::from_string("127.0.0.1"), 0);
+    server.listen(ep);
+    server.start_accept();
+
+    ws_websocketpp::lib::asio::error_code aec;
+    unsigned short port = server.get_local_endpoint(aec).port();
+
+    char uri[64];
+    std::snprintf(uri, sizeof(uri), "ws://127.0.0.1:%u/", port);
+    ws_websocketpp::lib::error_code ec;
+    client_type::connection_ptr con = client.get_connection(uri, ec);
+    if (ec) {
+      std::fprintf(stderr, "get_connection failed: %s\n", ec.message().c_str());
+      std::exit(1);
+    }
+    con->set_write_coalescing(opts.writeMaxBytes, opts.writeMaxFrames, opts.writeFlushDelay);
+    client.connect(con);
+
+    ios.run();
+    if (!open) {
+      std::fprintf(stderr, "Unable to connect to %s\n", uri);
+      std::exit(1);
+    }
+  }
+
+  BenchResult run(const std::string& data, opcode op, size_t iterations) {
+    // One untimed round trip to warm up the connections' buffers.
+    runMessages(data, op, 1);
+
+    uint64_t allocsBefore = allocCount();
+    BenchClock::time_point start = BenchClock::now();
+    runMessages(data, op, iterations);
+
+    BenchResult r;
+    r.seconds = secondsSince(start);
+    r.allocs = allocCount() - allocsBefore;
+    r.messages = received;
+    r.bytes = receivedBytes;
+    return r;
+  }
+
+private:
+  void runMessages(const std::string& data, opcode op, size_t n) {
+    payload = &data;
+    payloadOp = op;
+    remaining = n;
+    outstanding = 0;
+    received = 0;
+    receivedBytes = 0;
+
+    while (outstanding < window && remaining > 0) {
+      sendNext();
+    }
+    ios.reset();
+    ios.run();
+
+    if (received != n) {
+      std::fprintf(stderr, "Expected %zu messages, received %zu\n", n, received);
+      std::exit(1);
+    }
+  }
+
+  void sendNext() {
+    ws_websocketpp::lib::error_code ec;
+    client.send(clientHdl, payload->data(), payload->size(), payloadOp, ec);
+    if (ec) {
+      std::fprintf(stderr, "send failed: %s\n", ec.message().c_str());
+      std::exit(1);
+    }
+    remaining--;
+    outstanding++;
+  }
+
+  void onClientOpen(ws_websocketpp::connection_hdl hdl) {
+    clientHdl = hdl;
+    open = true;
+    ios.stop();
+  }
+
+  void onClientFail(ws_websocketpp::connection_hdl) {
+    ios.stop();
+  }
+
+  void onClientMessage(ws_websocketpp::connection_hdl, client_type::message_ptr msg) {
+    outstanding--;
+    received++;
+    receivedBytes += msg->get_payload().size();
+
+    if (remaining > 0) {
+      sendNext();
+    } else if (outstanding == 0) {
+      ios.stop();
+    }
+  }
+
+  void onServerOpen(ws_websocketpp::connection_hdl hdl) {
+    server.get_con_from_hdl(hdl)->set_write_coalescing(
+      opts.writeMaxBytes, opts.writeMaxFrames, opts.writeFlushDelay);
+  }
+
+  void onServerMessage(ws_websocketpp::connection_hdl hdl, server_type::message_ptr msg) {
+    ws_websocketpp::lib::error_code ec;
+    server.send(hdl, msg->get_payload(), msg->get_opcode(), ec);
+    if (ec) {
+      std::fprintf(stderr, "echo failed: %s\n", ec.message().c_str());
+      std::exit(1);
+    }
+  }
+
+  const BenchOptions& opts;
+  ws_websocketpp::lib::asio::io_service ios;
+  server_type server;
+  client_type client;
+  ws_websocketpp::connection_hdl clientHdl;
+  bool open;
+
+  const std::string* payload;
+  opcode payloadOp;
+  size_t remaining;
+  size_t outstanding;
+  size_t received;
+  size_t receivedBytes;
+};
+
+int main(int argc, char** argv) {
+  BenchOptions opts = parseOptions(argc, argv);
+  std::vector<size_t> sizes = messageSizes(opts);
+
+  Loopback loopback(opts);
+
+  printHeader("mode");
+  for (size_t k = 0; k < sizeof(payloadKinds) / sizeof(payloadKinds[0]); k++) {
+    PayloadKind kind = payloadKinds[k];
+    if (!selected(opts.utf8, isText(kind))) {
+      continue;
+    }
+    opcode op = isText(kind) ? ws_websocketpp::frame::opcode::text
+                             : ws_websocketpp::frame::opcode::binary;
+    for (size_t i = 0; i < sizes.size(); i++) {
+      std::string payload = makePayload(sizes[i], kind);
+      BenchResult r = loopback.run(payload, op, iterationsFor(opts, sizes[i]));
+      printResult("echo", kind, true, sizes[i], r);
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,118 @@
+#include "capture.h"
+#include <cstring>
+#include <stdexcept>
+
+static const char captureMagic[8] = { 'W', 'S', 'C', 'A', 'P', '0', '0', '1' };
+
+static void putLE(unsigned char* out, uint64_t value, size_t bytes) {
+  for (size_t i = 0; i < bytes; i++) {
+    out[i] = static_cast<unsigned char>(value >> (8 * i));
+  }
+}
+
+static uint64_t getLE(const unsigned char* in, size_t bytes) {
+  uint64_t value = 0;
+  for (size_t i = 0; i < bytes; i++) {
+    value |= static_cast<uint64_t>(in[i]) << (8 * i);
+  }
+  return value;
+}
+
+// Bytes of padding after `len` bytes of data, to reach a multiple of 8.
+static size_t padding(size_t len) {
+  return (8 - len % 8) % 8;
+}
+
+CaptureWriter::CaptureWriter(const std::string& path)
+  : start(std::chrono::steady_clock::now())
+{
+  file = std::fopen(path.c_str(), "wb");
+  if (file == NULL) {
+    throw std::runtime_error("Could not create capture file: " + path);
+  }
+  // A large buffer, so that the background thread seldom waits for the disk.
+  std::setvbuf(file, NULL, _IOFBF, 1024 * 1024);
+
+  unsigned char header[16];
+  std::memcpy(header, captureMagic, 8);
+  uint64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::system_clock::now().time_since_epoch()
+  ).count();
+  putLE(header + 8, now, 8);
+  if (std::fwrite(header, 1, sizeof(header), file) != sizeof(header)) {
+    std::fclose(file);
+    throw std::runtime_error("Could not write capture file: " + path);
+  }
+}
+
+CaptureWriter::~CaptureWriter() {
+  std::fclose(file);
+}
+
+void CaptureWriter::open(const std::string& response) {
+  write(CAPTURE_OPEN, response.data(), response.size());
+}
+
+void CaptureWriter::data(const char* buf, size_t len) {
+  write(CAPTURE_DATA, buf, len);
+}
+
+void CaptureWriter::flush() {
+  lock_guard<mutex> lock(fileMutex);
+  if (!failed && std::fflush(file) != 0) {
+    failed = true;
+  }
+}
+
+void CaptureWriter::write(uint32_t type, const char* buf, size_t len) {
+  uint64_t time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now() - start
+  ).count();
+  unsigned char header[16];
+  putLE(header, time, 8);
+  putLE(header + 8, type, 4);
+  putLE(header + 12, len, 4);
+  static const char zeros[8] = { 0 };
+
+  lock_guard<mutex> lock(fileMutex);
+  if (failed) {
+    return;
+  }
+  if (std::fwrite(header, 1, sizeof(header), file) != sizeof(header) ||
+      std::fwrite(buf, 1, len, file) != len ||
+      std::fwrite(zeros, 1, padding(len), file) != padding(len))
+  {
+    failed = true;
+  }
+}
+
+CaptureReader::CaptureReader(const std::string& path)
+  : in(path.c_str(), std::ios::in | std::ios::binary)
+{
+  if (!in) {
+    throw std::runtime_error("Could not open capture file: " + path);
+  }
+  char header[16];
+  if (!in.read(header, sizeof(header)) || std::memcmp(header, captureMagic, 8) != 0) {
+    throw std::runtime_error("Not a capture file: " + path);
+  }
+  if (!next(&first) || first.type != CAPTURE_OPEN) {
+    throw std::runtime_error("Capture file has no connection: " + path);
+  }
+}
+
+bool CaptureReader::next(CaptureRecord* record) {
+  unsigned char header[16];
+  if (!in.read(reinterpret_cast<char*>(header), sizeof(header))) {
+    return false;
+  }
+  record->time = getLE(header, 8);
+  record->type = static_cast<uint32_t>(getLE(header + 8, 4));
+  size_t len = static_cast<size_t>(getLE(header + 12, 4));
+  record->data.resize(len);
+  if (len > 0 && !in.read(&record->data[0], len)) {
+    return false;
+  }
+  in.ignore(padding(len));
+  return true;
+}
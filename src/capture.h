@@ -0,0 +1,89 @@
+#ifndef CAPTURE_HPP
+#define CAPTURE_HPP
+
+#include "websocket_defs.h"
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <string>
+
+// Capture files hold the raw bytes that a connection reads from the network,
+// with the times they arrived, so that the traffic can be replayed into a
+// client later (see ReplayClient).
+//
+// The format is append-only, and is laid out so that the file can also be
+// memory-mapped and walked in place: all integers are little-endian, and every
+// record starts at a multiple of 8 bytes.
+//
+//   File header (16 bytes):
+//     char[8]  magic, "WSCAP001"
+//     uint64   wall clock time the capture started, in ns since 1970
+//   Each record (16 bytes, then the data, padded with zeros to a multiple
+//   of 8):
+//     uint64   time the bytes arrived, in ns since the capture started
+//     uint32   type, CAPTURE_OPEN or CAPTURE_DATA
+//     uint32   length of the data
+//
+// A CAPTURE_OPEN record holds the server's handshake response, and starts a
+// connection; it's followed by CAPTURE_DATA records, one per read, holding
+// the WebSocket frames as they arrived, which may split or join frames. A
+// connection that reconnects starts another CAPTURE_OPEN record.
+
+enum CaptureRecordType : uint32_t {
+  CAPTURE_OPEN = 1,
+  CAPTURE_DATA = 2
+};
+
+struct CaptureRecord {
+  uint64_t time;
+  uint32_t type;
+  std::string data;
+};
+
+// Writes a capture file. open() and data() are called on the background
+// thread; records are buffered, and written when the buffer fills or on
+// flush(). If a write fails, the rest of the capture is dropped.
+class CaptureWriter {
+public:
+  // Throws std::runtime_error if the file can't be created.
+  explicit CaptureWriter(const std::string& path);
+  ~CaptureWriter();
+
+  void open(const std::string& response);
+  void data(const char* buf, size_t len);
+  void flush();
+
+private:
+  void write(uint32_t type, const char* buf, size_t len);
+
+  mutex fileMutex;
+  FILE* file;
+  bool failed = false;
+  std::chrono::steady_clock::time_point start;
+};
+
+// Reads a capture file, one record at a time, so that large captures don't
+// have to fit in memory.
+class CaptureReader {
+public:
+  // Reads the file header and the first record, which must be a
+  // CAPTURE_OPEN record. Throws std::runtime_error if the file can't be read
+  // or isn't a capture file.
+  explicit CaptureReader(const std::string& path);
+
+  // The handshake response from the first CAPTURE_OPEN record, and the time
+  // it arrived.
+  const CaptureRecord& openRecord() const { return first; }
+
+  // Read the next record after the first CAPTURE_OPEN record. Returns false
+  // at the end of the file, or if the file is cut off in the middle of a
+  // record.
+  bool next(CaptureRecord* record);
+
+private:
+  std::ifstream in;
+  CaptureRecord first;
+};
+
+#endif
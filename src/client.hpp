@@ -7,6 +7,8 @@
 #include <websocketpp/config/asio_no_tls_client.hpp>
 #include <websocketpp/config/asio_client.hpp>
 #include <websocketpp/client.hpp>
+#include <websocketpp/extensions/permessage_deflate/enabled.hpp>
+#include "message_pool.h"
 
 // This is necessary on CentOS 7, where bringing in asio_client.hpp indirectly loads
 // krb5/krb5.h, which defines TRUE/FALSE as integers. This then breaks R, as it
@@ -15,22 +17,55 @@
 #undef FALSE
 
 
-typedef ws_websocketpp::config::asio_client::message_type::ptr message_ptr;
+// All of the client configs get their message buffers from a pool that is
+// shared by every connection, instead of allocating (and freeing) a message for
+// each frame that is sent or received.
+template <typename base>
+struct pooled_config : public base {
+  typedef ws_websocketpp::message_buffer::message
+    <message_pool::ConMsgManager> message_type;
+  typedef message_pool::ConMsgManager<message_type> con_msg_manager_type;
+  typedef message_pool::EndpointMsgManager<con_msg_manager_type> endpoint_msg_manager_type;
+};
+struct client_config : public pooled_config<ws_websocketpp::config::asio_client> {};
+struct tls_client_config : public pooled_config<ws_websocketpp::config::asio_tls_client> {};
+
+typedef client_config::message_type::ptr message_ptr;
 typedef ws_websocketpp::lib::function<void(ws_websocketpp::connection_hdl, message_ptr)> message_handler;
 typedef ws_websocketpp::lib::function<void(ws_websocketpp::connection_hdl)> close_handler;
-typedef ws_websocketpp::client<ws_websocketpp::config::asio_client> ws_client;
-typedef ws_websocketpp::client<ws_websocketpp::config::asio_tls_client> wss_client;
+typedef ws_websocketpp::client<client_config> ws_client;
+typedef ws_websocketpp::client<tls_client_config> wss_client;
+
+// Client configs with the permessage-deflate extension enabled. These are
+// used only for connections created with compression, so that connections
+// without it don't carry any zlib state.
+struct asio_client_deflate : public client_config {
+  typedef ws_websocketpp::extensions::permessage_deflate::enabled
+    <permessage_deflate_config> permessage_deflate_type;
+};
+struct asio_tls_client_deflate : public tls_client_config {
+  typedef ws_websocketpp::extensions::permessage_deflate::enabled
+    <permessage_deflate_config> permessage_deflate_type;
+};
+typedef ws_websocketpp::client<asio_client_deflate> ws_deflate_client;
+typedef ws_websocketpp::client<asio_tls_client_deflate> wss_deflate_client;
 
 // The Client interface is mostly a thin wrapper for the
 // ws_websocketpp::client<T> class that is typedefed above to ws_client and
 // wss_client. Client in turn has derived template class ClientImpl<T>, which
-// can take ws_client/wss_client classes.
+// can take ws_client/wss_client classes. The parts of ClientImpl<T> that don't
+// depend on the transport are in its base class, ClientBase<T>, which is
+// shared with ReplayClient<T> (see replay_client.hpp).
 //
 // One important difference between the ClientImpl<T> class and the ws_client/
 // wss_client classes is that ClientImpl<T> stores the T::connection_ptr
 // object, so that it doesn't have to be passed to some of the methods like
 // connect(). This is so that all instances of the template class can use the
 // same Client interface.
+//
+// ClientBase<T> also keeps the settings that apply to the connection object,
+// so that reconnect() can replace the connection with a new one that is set
+// up the same way, using the same endpoint and io_service.
 
 class Client {
 public:
@@ -40,18 +75,27 @@ public:
   virtual void clear_error_channels(ws_websocketpp::log::level channels) = 0;
   virtual void update_log_channels(std::string accessOrError, std::string setOrClear, cpp11::strings logChannels) = 0;
   virtual void init_asio() = 0;
+  virtual void init_asio(ws_websocketpp::lib::asio::io_service* io_service) = 0;
   virtual void set_tls_init_handler(ws_websocketpp::transport::asio::tls_socket::tls_init_handler h) = 0;
+  virtual void set_socket_init_handler(ws_websocketpp::transport::asio::tls_socket::socket_init_handler h) = 0;
+  virtual void set_resolve_cache(ws_websocketpp::transport::asio::resolve_cache* cache) = 0;
   virtual void set_open_handler(ws_websocketpp::open_handler h) = 0;
   virtual void set_message_handler(message_handler h) = 0;
   virtual void set_close_handler(close_handler h) = 0;
   virtual void set_fail_handler(ws_websocketpp::fail_handler h) = 0;
+  virtual void set_write_complete_handler(ws_websocketpp::write_complete_handler h) = 0;
+  virtual void set_read_complete_handler(ws_websocketpp::read_complete_handler h) = 0;
+  virtual void set_read_data_handler(ws_websocketpp::read_data_handler h) = 0;
+  virtual void set_pong_handler(ws_websocketpp::pong_handler h) = 0;
 
   virtual void setup_connection(std::string location, ws_websocketpp::lib::error_code &ec) = 0;
   virtual void append_header(std::string key, std::string value) = 0;
   virtual void add_subprotocol(std::string const & request) = 0;
   virtual void connect() = 0;
+  virtual void reconnect(ws_websocketpp::lib::error_code &ec) = 0;
 
   virtual std::string get_subprotocol() const = 0;
+  virtual std::string get_handshake_response() const = 0;
 
   virtual std::size_t run() = 0;
   virtual std::size_t run_one() = 0;
@@ -61,11 +105,19 @@ public:
                     ws_websocketpp::frame::opcode::value op = ws_websocketpp::frame::opcode::text) = 0;
   virtual void send(void const * payload, size_t len,
                     ws_websocketpp::frame::opcode::value op = ws_websocketpp::frame::opcode::binary) = 0;
+  virtual message_ptr get_message(ws_websocketpp::frame::opcode::value op, size_t size) = 0;
+  virtual void send_many(std::vector<message_ptr> const& msgs) = 0;
   virtual void reset() = 0;
   virtual void close(ws_websocketpp::close::status::value const code, std::string const & reason) = 0;
   virtual void stop() = 0;
   virtual bool stopped() = 0;
   virtual void set_max_message_size(size_t mms) = 0;
+  virtual void set_stream_chunk_size(size_t size) = 0;
+  virtual void set_keepalive(long interval, long timeout) = 0;
+  virtual void set_write_coalescing(size_t maxBytes, size_t maxFrames, long flushDelay) = 0;
+  virtual size_t get_buffered_amount() const = 0;
+  virtual void pause_reading() = 0;
+  virtual void resume_reading() = 0;
 
   virtual ws_websocketpp::lib::error_code get_ec() const = 0;
   virtual ws_websocketpp::close::status::value get_remote_close_code() const = 0;
@@ -74,7 +126,7 @@ public:
 
 
 template <class T>
-class ClientImpl : public Client {
+class ClientBase : public Client {
 
 public:
   void set_access_channels(ws_websocketpp::log::level channels) {
@@ -111,10 +163,6 @@ public:
       }
     }
   }
-  void init_asio() {
-    client.init_asio();
-  };
-  void set_tls_init_handler(ws_websocketpp::transport::asio::tls_socket::tls_init_handler h);
   void set_open_handler(ws_websocketpp::open_handler h) {
     client.set_open_handler(h);
   };
@@ -127,20 +175,38 @@ public:
   void set_fail_handler(ws_websocketpp::fail_handler h) {
     client.set_fail_handler(h);
   };
+  // The endpoint has no default for this handler, so it is set on the
+  // connection; this must be called after setup_connection().
+  void set_write_complete_handler(ws_websocketpp::write_complete_handler h) {
+    settings.writeCompleteHandler = h;
+    con->set_write_complete_handler(h);
+  };
+  void set_read_complete_handler(ws_websocketpp::read_complete_handler h) {
+    settings.readCompleteHandler = h;
+    con->set_read_complete_handler(h);
+  };
+  void set_read_data_handler(ws_websocketpp::read_data_handler h) {
+    settings.readDataHandler = h;
+    con->set_read_data_handler(h);
+  };
+  // Like set_write_complete_handler(), this is set on the connection.
+  void set_pong_handler(ws_websocketpp::pong_handler h) {
+    settings.pongHandler = h;
+    con->set_pong_handler(h);
+  };
 
   void setup_connection(std::string location, ws_websocketpp::lib::error_code &ec) {
     this->con = client.get_connection(location, ec);
+    settings.location = location;
   };
   void append_header(std::string key, std::string value) {
+    settings.headers.push_back(std::make_pair(key, value));
     this->con->append_header(key, value);
   }
   void add_subprotocol(std::string const & value) {
+    settings.subprotocols.push_back(value);
     con->add_subprotocol(value);
   };
-  void connect() {
-    client.connect(this->con);
-  };
-
   std::string get_subprotocol() const {
     if (!con) {
       return std::string();
@@ -148,38 +214,15 @@ public:
       return con->get_subprotocol();
     }
   }
+  // The server's response to the opening handshake, as it was received.
+  std::string get_handshake_response() const {
+    return con->get_response().raw();
+  }
 
-  std::size_t run() {
-    return client.run();
-  };
-  std::size_t run_one() {
-    return client.run_one();
-  };
-  ws_websocketpp::lib::asio::io_service& get_io_service() {
-    return client.get_io_service();
-  };
-  std::size_t poll() {
-    return client.poll();
-  };
-  void send(std::string const& payload, ws_websocketpp::frame::opcode::value op) {
-    client.send(this->con, payload, op);
-  };
-  void send(void const* payload, size_t len, ws_websocketpp::frame::opcode::value op) {
-    client.send(this->con, payload, len, op);
-  };
-  void reset() {
-    client.reset();
+  // Create an empty message buffer for use with send_many().
+  message_ptr get_message(ws_websocketpp::frame::opcode::value op, size_t size) {
+    return con->get_message(op, size);
   };
-  void close(ws_websocketpp::close::status::value const code, std::string const& reason) {
-    client.close(this->con, code, reason);
-  };
-  void stop() {
-    return client.stop();
-  };
-  bool stopped() {
-    return client.stopped();
-  };
-
   ws_websocketpp::lib::error_code get_ec() const {
     return this->con->get_ec();
   }
@@ -192,12 +235,80 @@ public:
   void set_max_message_size(size_t mms){
     client.set_max_message_size(mms);
   }
+  void set_stream_chunk_size(size_t size) {
+    settings.streamChunkSize = size;
+    con->set_stream_chunk_size(size);
+  }
+  void set_keepalive(long interval, long timeout) {
+    settings.keepaliveInterval = interval;
+    settings.pongTimeout = timeout;
+    con->set_keepalive(interval);
+    con->set_pong_timeout(timeout);
+  }
+  void set_write_coalescing(size_t maxBytes, size_t maxFrames, long flushDelay) {
+    settings.coalesce = true;
+    settings.writeMaxBytes = maxBytes;
+    settings.writeMaxFrames = maxFrames;
+    settings.writeFlushDelay = flushDelay;
+    con->set_write_coalescing(maxBytes, maxFrames, flushDelay);
+  }
+  // Payload bytes that have been sent but not yet written to the network.
+  size_t get_buffered_amount() const {
+    if (!con) {
+      return 0;
+    }
+    return con->get_unsent_amount();
+  }
+  // Stop reading from the socket. This takes effect immediately, and must be
+  // called from one of this connection's handlers, on the background thread.
+  void pause_reading() {
+    con->handle_pause_reading();
+  }
 
 
-private:
+protected:
   T client;
   typename T::connection_ptr con;
 
+  // Everything that has been set on con, for reconnect().
+  struct ConnectionSettings {
+    std::string location;
+    std::vector<std::pair<std::string, std::string>> headers;
+    std::vector<std::string> subprotocols;
+    ws_websocketpp::write_complete_handler writeCompleteHandler;
+    ws_websocketpp::read_complete_handler readCompleteHandler;
+    ws_websocketpp::read_data_handler readDataHandler;
+    ws_websocketpp::pong_handler pongHandler;
+    size_t streamChunkSize = 0;
+    long keepaliveInterval = 0;
+    long pongTimeout = 0;
+    bool coalesce = false;
+    size_t writeMaxBytes = 0;
+    size_t writeMaxFrames = 0;
+    long writeFlushDelay = 0;
+  } settings;
+
+  void apply_settings() {
+    for (size_t i = 0; i < settings.headers.size(); i++) {
+      con->append_header(settings.headers[i].first, settings.headers[i].second);
+    }
+    for (size_t i = 0; i < settings.subprotocols.size(); i++) {
+      con->add_subprotocol(settings.subprotocols[i]);
+    }
+    con->set_write_complete_handler(settings.writeCompleteHandler);
+    con->set_read_complete_handler(settings.readCompleteHandler);
+    con->set_read_data_handler(settings.readDataHandler);
+    con->set_pong_handler(settings.pongHandler);
+    con->set_stream_chunk_size(settings.streamChunkSize);
+    if (settings.keepaliveInterval > 0) {
+      con->set_keepalive(settings.keepaliveInterval);
+      con->set_pong_timeout(settings.pongTimeout);
+    }
+    if (settings.coalesce) {
+      con->set_write_coalescing(settings.writeMaxBytes, settings.writeMaxFrames, settings.writeFlushDelay);
+    }
+  }
+
   ws_websocketpp::log::level getAccessLogLevel(std::string logLevel) {
     if      (logLevel == "none")            return ws_websocketpp::log::alevel::none;
     else if (logLevel == "connect")         return ws_websocketpp::log::alevel::connect;
@@ -236,11 +347,113 @@ private:
 };
 
 
+// A Client for a connection over the network, using the asio transport.
+template <class T>
+class ClientImpl : public ClientBase<T> {
+
+public:
+  void init_asio() {
+    this->client.init_asio();
+  };
+  // Use an io_service that is owned elsewhere and shared with other
+  // connections (see IoPool).
+  void init_asio(ws_websocketpp::lib::asio::io_service* io_service) {
+    this->client.init_asio(io_service);
+    externalIo = true;
+  };
+  void set_tls_init_handler(ws_websocketpp::transport::asio::tls_socket::tls_init_handler h);
+  void set_socket_init_handler(ws_websocketpp::transport::asio::tls_socket::socket_init_handler h);
+  void set_resolve_cache(ws_websocketpp::transport::asio::resolve_cache* cache) {
+    this->client.set_resolve_cache(cache);
+  };
+
+  void connect() {
+    this->client.connect(this->con);
+  };
+  // Replace the connection with a new one to the same location, with the same
+  // settings, and connect it. This must be called on the main thread, after
+  // the old connection has closed.
+  void reconnect(ws_websocketpp::lib::error_code &ec) {
+    typename T::connection_ptr newCon = this->client.get_connection(this->settings.location, ec);
+    if (ec) {
+      return;
+    }
+    this->con = newCon;
+    this->apply_settings();
+    this->client.connect(this->con);
+  };
+
+  std::size_t run() {
+    return this->client.run();
+  };
+  std::size_t run_one() {
+    return this->client.run_one();
+  };
+  ws_websocketpp::lib::asio::io_service& get_io_service() {
+    return this->client.get_io_service();
+  };
+  std::size_t poll() {
+    return this->client.poll();
+  };
+  void send(std::string const& payload, ws_websocketpp::frame::opcode::value op) {
+    this->client.send(this->con, payload, op);
+  };
+  void send(void const* payload, size_t len, ws_websocketpp::frame::opcode::value op) {
+    this->client.send(this->con, payload, len, op);
+  };
+
+  // Queue all of the messages with a single lock of the send queue. Like
+  // send(), this throws on error.
+  void send_many(std::vector<message_ptr> const& msgs) {
+    ws_websocketpp::lib::error_code ec = this->con->send_many(msgs);
+    if (ec) {
+      throw ws_websocketpp::exception(ec);
+    }
+  };
+  void reset() {
+    this->client.reset();
+  };
+  void close(ws_websocketpp::close::status::value const code, std::string const& reason) {
+    this->client.close(this->con, code, reason);
+  };
+  void stop() {
+    if (externalIo) {
+      // The io_service is shared with other connections, so shut down only
+      // this connection.
+      if (this->con) {
+        ws_websocketpp::lib::error_code ec;
+        this->con->close(ws_websocketpp::close::status::going_away, "", ec);
+      }
+      return;
+    }
+    return this->client.stop();
+  };
+  bool stopped() {
+    if (externalIo) {
+      return !this->con || this->con->get_state() == ws_websocketpp::session::state::closed;
+    }
+    return this->client.stopped();
+  };
+
+  // Start reading again. This can be called from any thread.
+  void resume_reading() {
+    this->con->resume_reading();
+  }
+
+private:
+  bool externalIo = false;
+};
+
 
 // Specializations for set_tls_init_handler()
 template <>
 inline void ClientImpl<wss_client>::set_tls_init_handler(ws_websocketpp::transport::asio::tls_socket::tls_init_handler h) {
-  client.set_tls_init_handler(h);
+  this->client.set_tls_init_handler(h);
+}
+
+template <>
+inline void ClientImpl<wss_deflate_client>::set_tls_init_handler(ws_websocketpp::transport::asio::tls_socket::tls_init_handler h) {
+  this->client.set_tls_init_handler(h);
 }
 
 template <>
@@ -248,4 +461,30 @@ inline void ClientImpl<ws_client>::set_tls_init_handler(ws_websocketpp::transpor
   throw std::runtime_error("Can't set TLS init handler for ws:// connection.");
 }
 
+template <>
+inline void ClientImpl<ws_deflate_client>::set_tls_init_handler(ws_websocketpp::transport::asio::tls_socket::tls_init_handler h) {
+  throw std::runtime_error("Can't set TLS init handler for ws:// connection.");
+}
+
+// Specializations for set_socket_init_handler()
+template <>
+inline void ClientImpl<wss_client>::set_socket_init_handler(ws_websocketpp::transport::asio::tls_socket::socket_init_handler h) {
+  this->client.set_socket_init_handler(h);
+}
+
+template <>
+inline void ClientImpl<wss_deflate_client>::set_socket_init_handler(ws_websocketpp::transport::asio::tls_socket::socket_init_handler h) {
+  this->client.set_socket_init_handler(h);
+}
+
+template <>
+inline void ClientImpl<ws_client>::set_socket_init_handler(ws_websocketpp::transport::asio::tls_socket::socket_init_handler h) {
+  throw std::runtime_error("Can't set TLS socket init handler for ws:// connection.");
+}
+
+template <>
+inline void ClientImpl<ws_deflate_client>::set_socket_init_handler(ws_websocketpp::transport::asio::tls_socket::socket_init_handler h) {
+  throw std::runtime_error("Can't set TLS socket init handler for ws:// connection.");
+}
+
 #endif
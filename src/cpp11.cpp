@@ -6,10 +6,10 @@
 #include <R_ext/Visibility.h>
 
 // websocket.cpp
-SEXP wsCreate(std::string uri, int loop_id, cpp11::environment robjPublic, cpp11::environment robjPrivate, cpp11::strings accessLogChannels, cpp11::strings errorLogChannels, int maxMessageSize);
-extern "C" SEXP _websocket_wsCreate(SEXP uri, SEXP loop_id, SEXP robjPublic, SEXP robjPrivate, SEXP accessLogChannels, SEXP errorLogChannels, SEXP maxMessageSize) {
+SEXP wsCreate(std::string uri, int loop_id, cpp11::environment robjPublic, cpp11::environment robjPrivate, cpp11::strings accessLogChannels, cpp11::strings errorLogChannels, int maxMessageSize, bool batchMessages, bool sharedIo, int ioThreads, cpp11::list compression, cpp11::list replay);
+extern "C" SEXP _websocket_wsCreate(SEXP uri, SEXP loop_id, SEXP robjPublic, SEXP robjPrivate, SEXP accessLogChannels, SEXP errorLogChannels, SEXP maxMessageSize, SEXP batchMessages, SEXP sharedIo, SEXP ioThreads, SEXP compression, SEXP replay) {
   BEGIN_CPP11
-    return cpp11::as_sexp(wsCreate(cpp11::as_cpp<cpp11::decay_t<std::string>>(uri), cpp11::as_cpp<cpp11::decay_t<int>>(loop_id), cpp11::as_cpp<cpp11::decay_t<cpp11::environment>>(robjPublic), cpp11::as_cpp<cpp11::decay_t<cpp11::environment>>(robjPrivate), cpp11::as_cpp<cpp11::decay_t<cpp11::strings>>(accessLogChannels), cpp11::as_cpp<cpp11::decay_t<cpp11::strings>>(errorLogChannels), cpp11::as_cpp<cpp11::decay_t<int>>(maxMessageSize)));
+    return cpp11::as_sexp(wsCreate(cpp11::as_cpp<cpp11::decay_t<std::string>>(uri), cpp11::as_cpp<cpp11::decay_t<int>>(loop_id), cpp11::as_cpp<cpp11::decay_t<cpp11::environment>>(robjPublic), cpp11::as_cpp<cpp11::decay_t<cpp11::environment>>(robjPrivate), cpp11::as_cpp<cpp11::decay_t<cpp11::strings>>(accessLogChannels), cpp11::as_cpp<cpp11::decay_t<cpp11::strings>>(errorLogChannels), cpp11::as_cpp<cpp11::decay_t<int>>(maxMessageSize), cpp11::as_cpp<cpp11::decay_t<bool>>(batchMessages), cpp11::as_cpp<cpp11::decay_t<bool>>(sharedIo), cpp11::as_cpp<cpp11::decay_t<int>>(ioThreads), cpp11::as_cpp<cpp11::decay_t<cpp11::list>>(compression), cpp11::as_cpp<cpp11::decay_t<cpp11::list>>(replay)));
   END_CPP11
 }
 // websocket.cpp
@@ -29,6 +29,109 @@ extern "C" SEXP _websocket_wsAddProtocols(SEXP wsc_xptr, SEXP protocols) {
   END_CPP11
 }
 // websocket.cpp
+void wsSetWriteCoalescing(SEXP wsc_xptr, double maxBytes, int maxFrames, int flushDelay);
+extern "C" SEXP _websocket_wsSetWriteCoalescing(SEXP wsc_xptr, SEXP maxBytes, SEXP maxFrames, SEXP flushDelay) {
+  BEGIN_CPP11
+    wsSetWriteCoalescing(cpp11::as_cpp<cpp11::decay_t<SEXP>>(wsc_xptr), cpp11::as_cpp<cpp11::decay_t<double>>(maxBytes), cpp11::as_cpp<cpp11::decay_t<int>>(maxFrames), cpp11::as_cpp<cpp11::decay_t<int>>(flushDelay));
+    return R_NilValue;
+  END_CPP11
+}
+// websocket.cpp
+void wsSetWaterMarks(SEXP wsc_xptr, double high, double low);
+extern "C" SEXP _websocket_wsSetWaterMarks(SEXP wsc_xptr, SEXP high, SEXP low) {
+  BEGIN_CPP11
+    wsSetWaterMarks(cpp11::as_cpp<cpp11::decay_t<SEXP>>(wsc_xptr), cpp11::as_cpp<cpp11::decay_t<double>>(high), cpp11::as_cpp<cpp11::decay_t<double>>(low));
+    return R_NilValue;
+  END_CPP11
+}
+// websocket.cpp
+void wsSetMaxBacklog(SEXP wsc_xptr, double messages, double bytes);
+extern "C" SEXP _websocket_wsSetMaxBacklog(SEXP wsc_xptr, SEXP messages, SEXP bytes) {
+  BEGIN_CPP11
+    wsSetMaxBacklog(cpp11::as_cpp<cpp11::decay_t<SEXP>>(wsc_xptr), cpp11::as_cpp<cpp11::decay_t<double>>(messages), cpp11::as_cpp<cpp11::decay_t<double>>(bytes));
+    return R_NilValue;
+  END_CPP11
+}
+// websocket.cpp
+void wsSetStreamChunkSize(SEXP wsc_xptr, double size);
+extern "C" SEXP _websocket_wsSetStreamChunkSize(SEXP wsc_xptr, SEXP size) {
+  BEGIN_CPP11
+    wsSetStreamChunkSize(cpp11::as_cpp<cpp11::decay_t<SEXP>>(wsc_xptr), cpp11::as_cpp<cpp11::decay_t<double>>(size));
+    return R_NilValue;
+  END_CPP11
+}
+// websocket.cpp
+void wsSetKeepalive(SEXP wsc_xptr, int interval, int timeout);
+extern "C" SEXP _websocket_wsSetKeepalive(SEXP wsc_xptr, SEXP interval, SEXP timeout) {
+  BEGIN_CPP11
+    wsSetKeepalive(cpp11::as_cpp<cpp11::decay_t<SEXP>>(wsc_xptr), cpp11::as_cpp<cpp11::decay_t<int>>(interval), cpp11::as_cpp<cpp11::decay_t<int>>(timeout));
+    return R_NilValue;
+  END_CPP11
+}
+// websocket.cpp
+void wsSetReconnect(SEXP wsc_xptr, int maxAttempts, double initialDelay, double maxDelay);
+extern "C" SEXP _websocket_wsSetReconnect(SEXP wsc_xptr, SEXP maxAttempts, SEXP initialDelay, SEXP maxDelay) {
+  BEGIN_CPP11
+    wsSetReconnect(cpp11::as_cpp<cpp11::decay_t<SEXP>>(wsc_xptr), cpp11::as_cpp<cpp11::decay_t<int>>(maxAttempts), cpp11::as_cpp<cpp11::decay_t<double>>(initialDelay), cpp11::as_cpp<cpp11::decay_t<double>>(maxDelay));
+    return R_NilValue;
+  END_CPP11
+}
+// websocket.cpp
+void wsSetRawTextSize(SEXP wsc_xptr, double size);
+extern "C" SEXP _websocket_wsSetRawTextSize(SEXP wsc_xptr, SEXP size) {
+  BEGIN_CPP11
+    wsSetRawTextSize(cpp11::as_cpp<cpp11::decay_t<SEXP>>(wsc_xptr), cpp11::as_cpp<cpp11::decay_t<double>>(size));
+    return R_NilValue;
+  END_CPP11
+}
+// websocket.cpp
+void wsSetParseJson(SEXP wsc_xptr, bool simplifyVector);
+extern "C" SEXP _websocket_wsSetParseJson(SEXP wsc_xptr, SEXP simplifyVector) {
+  BEGIN_CPP11
+    wsSetParseJson(cpp11::as_cpp<cpp11::decay_t<SEXP>>(wsc_xptr), cpp11::as_cpp<cpp11::decay_t<bool>>(simplifyVector));
+    return R_NilValue;
+  END_CPP11
+}
+// websocket.cpp
+void wsSetConflation(SEXP wsc_xptr, std::string type, std::string pattern, double start, double length);
+extern "C" SEXP _websocket_wsSetConflation(SEXP wsc_xptr, SEXP type, SEXP pattern, SEXP start, SEXP length) {
+  BEGIN_CPP11
+    wsSetConflation(cpp11::as_cpp<cpp11::decay_t<SEXP>>(wsc_xptr), cpp11::as_cpp<cpp11::decay_t<std::string>>(type), cpp11::as_cpp<cpp11::decay_t<std::string>>(pattern), cpp11::as_cpp<cpp11::decay_t<double>>(start), cpp11::as_cpp<cpp11::decay_t<double>>(length));
+    return R_NilValue;
+  END_CPP11
+}
+// websocket.cpp
+void wsSetCapture(SEXP wsc_xptr, std::string path);
+extern "C" SEXP _websocket_wsSetCapture(SEXP wsc_xptr, SEXP path) {
+  BEGIN_CPP11
+    wsSetCapture(cpp11::as_cpp<cpp11::decay_t<SEXP>>(wsc_xptr), cpp11::as_cpp<cpp11::decay_t<std::string>>(path));
+    return R_NilValue;
+  END_CPP11
+}
+// websocket.cpp
+int wsAddFilter(SEXP wsc_xptr, std::string type, std::string pattern, bool hasValue, std::string value, bool drop, std::string topic);
+extern "C" SEXP _websocket_wsAddFilter(SEXP wsc_xptr, SEXP type, SEXP pattern, SEXP hasValue, SEXP value, SEXP drop, SEXP topic) {
+  BEGIN_CPP11
+    return cpp11::as_sexp(wsAddFilter(cpp11::as_cpp<cpp11::decay_t<SEXP>>(wsc_xptr), cpp11::as_cpp<cpp11::decay_t<std::string>>(type), cpp11::as_cpp<cpp11::decay_t<std::string>>(pattern), cpp11::as_cpp<cpp11::decay_t<bool>>(hasValue), cpp11::as_cpp<cpp11::decay_t<std::string>>(value), cpp11::as_cpp<cpp11::decay_t<bool>>(drop), cpp11::as_cpp<cpp11::decay_t<std::string>>(topic)));
+  END_CPP11
+}
+// websocket.cpp
+void wsRemoveFilter(SEXP wsc_xptr, int id);
+extern "C" SEXP _websocket_wsRemoveFilter(SEXP wsc_xptr, SEXP id) {
+  BEGIN_CPP11
+    wsRemoveFilter(cpp11::as_cpp<cpp11::decay_t<SEXP>>(wsc_xptr), cpp11::as_cpp<cpp11::decay_t<int>>(id));
+    return R_NilValue;
+  END_CPP11
+}
+// websocket.cpp
+void wsCallbacksChanged(SEXP wsc_xptr, std::string name);
+extern "C" SEXP _websocket_wsCallbacksChanged(SEXP wsc_xptr, SEXP name) {
+  BEGIN_CPP11
+    wsCallbacksChanged(cpp11::as_cpp<cpp11::decay_t<SEXP>>(wsc_xptr), cpp11::as_cpp<cpp11::decay_t<std::string>>(name));
+    return R_NilValue;
+  END_CPP11
+}
+// websocket.cpp
 void wsConnect(SEXP wsc_xptr);
 extern "C" SEXP _websocket_wsConnect(SEXP wsc_xptr) {
   BEGIN_CPP11
@@ -37,10 +140,52 @@ extern "C" SEXP _websocket_wsConnect(SEXP wsc_xptr) {
   END_CPP11
 }
 // websocket.cpp
-void wsSend(SEXP wsc_xptr, SEXP msg);
+bool wsSend(SEXP wsc_xptr, SEXP msg);
 extern "C" SEXP _websocket_wsSend(SEXP wsc_xptr, SEXP msg) {
   BEGIN_CPP11
-    wsSend(cpp11::as_cpp<cpp11::decay_t<SEXP>>(wsc_xptr), cpp11::as_cpp<cpp11::decay_t<SEXP>>(msg));
+    return cpp11::as_sexp(wsSend(cpp11::as_cpp<cpp11::decay_t<SEXP>>(wsc_xptr), cpp11::as_cpp<cpp11::decay_t<SEXP>>(msg)));
+  END_CPP11
+}
+// websocket.cpp
+bool wsSendMany(SEXP wsc_xptr, SEXP msgs);
+extern "C" SEXP _websocket_wsSendMany(SEXP wsc_xptr, SEXP msgs) {
+  BEGIN_CPP11
+    return cpp11::as_sexp(wsSendMany(cpp11::as_cpp<cpp11::decay_t<SEXP>>(wsc_xptr), cpp11::as_cpp<cpp11::decay_t<SEXP>>(msgs)));
+  END_CPP11
+}
+// websocket.cpp
+double wsBufferedAmount(SEXP wsc_xptr);
+extern "C" SEXP _websocket_wsBufferedAmount(SEXP wsc_xptr) {
+  BEGIN_CPP11
+    return cpp11::as_sexp(wsBufferedAmount(cpp11::as_cpp<cpp11::decay_t<SEXP>>(wsc_xptr)));
+  END_CPP11
+}
+// websocket.cpp
+cpp11::list wsLatency(SEXP wsc_xptr);
+extern "C" SEXP _websocket_wsLatency(SEXP wsc_xptr) {
+  BEGIN_CPP11
+    return cpp11::as_sexp(wsLatency(cpp11::as_cpp<cpp11::decay_t<SEXP>>(wsc_xptr)));
+  END_CPP11
+}
+// websocket.cpp
+cpp11::list wsStats(SEXP wsc_xptr);
+extern "C" SEXP _websocket_wsStats(SEXP wsc_xptr) {
+  BEGIN_CPP11
+    return cpp11::as_sexp(wsStats(cpp11::as_cpp<cpp11::decay_t<SEXP>>(wsc_xptr)));
+  END_CPP11
+}
+// websocket.cpp
+cpp11::list wsIoStats();
+extern "C" SEXP _websocket_wsIoStats() {
+  BEGIN_CPP11
+    return cpp11::as_sexp(wsIoStats());
+  END_CPP11
+}
+// websocket.cpp
+void wsSetDnsCacheTtl(double ttl);
+extern "C" SEXP _websocket_wsSetDnsCacheTtl(SEXP ttl) {
+  BEGIN_CPP11
+    wsSetDnsCacheTtl(cpp11::as_cpp<cpp11::decay_t<double>>(ttl));
     return R_NilValue;
   END_CPP11
 }
@@ -74,18 +219,46 @@ extern "C" SEXP _websocket_wsUpdateLogChannels(SEXP wsc_xptr, SEXP accessOrError
     return R_NilValue;
   END_CPP11
 }
+// websocket.cpp
+void wsTlsConfig(std::string caFile, std::string caPath, std::string ciphers, std::string certFile, std::string keyFile, bool verifyPeer, bool sessionResumption);
+extern "C" SEXP _websocket_wsTlsConfig(SEXP caFile, SEXP caPath, SEXP ciphers, SEXP certFile, SEXP keyFile, SEXP verifyPeer, SEXP sessionResumption) {
+  BEGIN_CPP11
+    wsTlsConfig(cpp11::as_cpp<cpp11::decay_t<std::string>>(caFile), cpp11::as_cpp<cpp11::decay_t<std::string>>(caPath), cpp11::as_cpp<cpp11::decay_t<std::string>>(ciphers), cpp11::as_cpp<cpp11::decay_t<std::string>>(certFile), cpp11::as_cpp<cpp11::decay_t<std::string>>(keyFile), cpp11::as_cpp<cpp11::decay_t<bool>>(verifyPeer), cpp11::as_cpp<cpp11::decay_t<bool>>(sessionResumption));
+    return R_NilValue;
+  END_CPP11
+}
 
 extern "C" {
 static const R_CallMethodDef CallEntries[] = {
-    {"_websocket_wsAddProtocols",      (DL_FUNC) &_websocket_wsAddProtocols,      2},
-    {"_websocket_wsAppendHeader",      (DL_FUNC) &_websocket_wsAppendHeader,      3},
-    {"_websocket_wsClose",             (DL_FUNC) &_websocket_wsClose,             3},
-    {"_websocket_wsConnect",           (DL_FUNC) &_websocket_wsConnect,           1},
-    {"_websocket_wsCreate",            (DL_FUNC) &_websocket_wsCreate,            7},
-    {"_websocket_wsProtocol",          (DL_FUNC) &_websocket_wsProtocol,          1},
-    {"_websocket_wsSend",              (DL_FUNC) &_websocket_wsSend,              2},
-    {"_websocket_wsState",             (DL_FUNC) &_websocket_wsState,             1},
-    {"_websocket_wsUpdateLogChannels", (DL_FUNC) &_websocket_wsUpdateLogChannels, 4},
+    {"_websocket_wsAddFilter",          (DL_FUNC) &_websocket_wsAddFilter,          7},
+    {"_websocket_wsAddProtocols",       (DL_FUNC) &_websocket_wsAddProtocols,       2},
+    {"_websocket_wsAppendHeader",       (DL_FUNC) &_websocket_wsAppendHeader,       3},
+    {"_websocket_wsBufferedAmount",     (DL_FUNC) &_websocket_wsBufferedAmount,     1},
+    {"_websocket_wsCallbacksChanged",   (DL_FUNC) &_websocket_wsCallbacksChanged,   2},
+    {"_websocket_wsClose",              (DL_FUNC) &_websocket_wsClose,              3},
+    {"_websocket_wsConnect",            (DL_FUNC) &_websocket_wsConnect,            1},
+    {"_websocket_wsCreate",             (DL_FUNC) &_websocket_wsCreate,            12},
+    {"_websocket_wsIoStats",            (DL_FUNC) &_websocket_wsIoStats,            0},
+    {"_websocket_wsLatency",            (DL_FUNC) &_websocket_wsLatency,            1},
+    {"_websocket_wsProtocol",           (DL_FUNC) &_websocket_wsProtocol,           1},
+    {"_websocket_wsRemoveFilter",       (DL_FUNC) &_websocket_wsRemoveFilter,       2},
+    {"_websocket_wsSend",               (DL_FUNC) &_websocket_wsSend,               2},
+    {"_websocket_wsSendMany",           (DL_FUNC) &_websocket_wsSendMany,           2},
+    {"_websocket_wsSetCapture",         (DL_FUNC) &_websocket_wsSetCapture,         2},
+    {"_websocket_wsSetConflation",      (DL_FUNC) &_websocket_wsSetConflation,      5},
+    {"_websocket_wsSetDnsCacheTtl",     (DL_FUNC) &_websocket_wsSetDnsCacheTtl,     1},
+    {"_websocket_wsSetKeepalive",       (DL_FUNC) &_websocket_wsSetKeepalive,       3},
+    {"_websocket_wsSetMaxBacklog",      (DL_FUNC) &_websocket_wsSetMaxBacklog,      3},
+    {"_websocket_wsSetParseJson",       (DL_FUNC) &_websocket_wsSetParseJson,       2},
+    {"_websocket_wsSetRawTextSize",     (DL_FUNC) &_websocket_wsSetRawTextSize,     2},
+    {"_websocket_wsSetReconnect",       (DL_FUNC) &_websocket_wsSetReconnect,       4},
+    {"_websocket_wsSetStreamChunkSize", (DL_FUNC) &_websocket_wsSetStreamChunkSize, 2},
+    {"_websocket_wsSetWaterMarks",      (DL_FUNC) &_websocket_wsSetWaterMarks,      3},
+    {"_websocket_wsSetWriteCoalescing", (DL_FUNC) &_websocket_wsSetWriteCoalescing, 4},
+    {"_websocket_wsState",              (DL_FUNC) &_websocket_wsState,              1},
+    {"_websocket_wsStats",              (DL_FUNC) &_websocket_wsStats,              1},
+    {"_websocket_wsTlsConfig",          (DL_FUNC) &_websocket_wsTlsConfig,          7},
+    {"_websocket_wsUpdateLogChannels",  (DL_FUNC) &_websocket_wsUpdateLogChannels,  4},
     {NULL, NULL, 0}
 };
 }
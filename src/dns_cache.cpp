@@ -0,0 +1,45 @@
+#include "dns_cache.h"
+
+DnsCache& DnsCache::instance() {
+  // Intentionally never deleted, since connections on the shared I/O threads
+  // may still use it during static destruction.
+  static DnsCache* cache = new DnsCache();
+  return *cache;
+}
+
+void DnsCache::setTtl(long ttl) {
+  lock_guard<mutex> lock(cacheMutex);
+  this->ttl = ttl;
+  if (ttl <= 0) {
+    entries.clear();
+  }
+}
+
+bool DnsCache::lookup(const std::string& host, const std::string& port, endpoint_list& out) {
+  lock_guard<mutex> lock(cacheMutex);
+  std::map<std::string, Entry>::iterator it = entries.find(key(host, port));
+  if (it == entries.end()) {
+    return false;
+  }
+  if (it->second.expires <= clock::now()) {
+    entries.erase(it);
+    return false;
+  }
+  out = it->second.endpoints;
+  return true;
+}
+
+void DnsCache::store(const std::string& host, const std::string& port, const endpoint_list& endpoints) {
+  lock_guard<mutex> lock(cacheMutex);
+  if (ttl <= 0 || endpoints.empty()) {
+    return;
+  }
+  Entry& entry = entries[key(host, port)];
+  entry.endpoints = endpoints;
+  entry.expires = clock::now() + ws_websocketpp::lib::chrono::milliseconds(ttl);
+}
+
+void DnsCache::erase(const std::string& host, const std::string& port) {
+  lock_guard<mutex> lock(cacheMutex);
+  entries.erase(key(host, port));
+}
@@ -0,0 +1,52 @@
+#ifndef DNS_CACHE_HPP
+#define DNS_CACHE_HPP
+
+#include "websocket_defs.h"
+#include <websocketpp/common/chrono.hpp>
+#include <map>
+#include <string>
+
+// DnsCache is a process-wide cache of DNS results, shared by all WebSocket
+// connections, so that many connections to the same host, or repeated
+// reconnects, don't each wait for a DNS lookup. Each connection's endpoint
+// uses it through websocketpp's resolve_cache hook.
+//
+// The system resolver doesn't report the TTLs of the records it returns, so
+// every entry is kept for the same time to live. The endpoint erases an entry
+// when none of its addresses can be connected to.
+//
+// All methods are thread safe.
+class DnsCache : public ws_websocketpp::transport::asio::resolve_cache {
+public:
+  static DnsCache& instance();
+
+  // Set the time to live, in milliseconds, of new entries. 0 turns the cache
+  // off and clears it. The default is 60000.
+  void setTtl(long ttl);
+
+  bool lookup(const std::string& host, const std::string& port, endpoint_list& out);
+  void store(const std::string& host, const std::string& port, const endpoint_list& endpoints);
+  void erase(const std::string& host, const std::string& port);
+
+private:
+  typedef ws_websocketpp::lib::chrono::steady_clock clock;
+
+  struct Entry {
+    endpoint_list endpoints;
+    clock::time_point expires;
+  };
+
+  DnsCache() {}
+  DnsCache(const DnsCache&) = delete;
+  DnsCache& operator=(const DnsCache&) = delete;
+
+  static std::string key(const std::string& host, const std::string& port) {
+    return host + ":" + port;
+  }
+
+  mutex cacheMutex;
+  std::map<std::string, Entry> entries;
+  long ttl = 60000;
+};
+
+#endif
@@ -0,0 +1,193 @@
+#include "filter.h"
+#include <algorithm>
+
+int MessageFilter::add(Rule rule) {
+  lock_guard<mutex> lock(rulesMutex);
+  rule.id = nextId++;
+  if (rule.type == MATCH_JSON) {
+    // Match the key with its quotes, so that "id" doesn't match "userid".
+    rule.pattern = "\"" + rule.pattern + "\"";
+  }
+  shared_ptr<std::vector<rule_ptr>> updated = make_shared<std::vector<rule_ptr>>(*rules);
+  updated->push_back(make_shared<const Rule>(rule));
+  rules = updated;
+  return rule.id;
+}
+
+void MessageFilter::remove(int id) {
+  lock_guard<mutex> lock(rulesMutex);
+  shared_ptr<std::vector<rule_ptr>> updated = make_shared<std::vector<rule_ptr>>();
+  for (size_t i = 0; i < rules->size(); i++) {
+    if ((*rules)[i]->id != id) {
+      updated->push_back((*rules)[i]);
+    }
+  }
+  rules = updated;
+}
+
+static bool isSpace(char c) {
+  return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+// Whether `c` can follow a bare JSON literal, like a number or true.
+static bool isLiteralEnd(char c) {
+  return isSpace(c) || c == ',' || c == '}' || c == ']';
+}
+
+// Find the next place, at or after *from, where `quotedKey` is used as an
+// object key, and return the offset of its value (after the colon and any
+// whitespace), or npos if there is none. *from is moved past the key, so
+// that the search can be continued.
+static size_t findJsonKey(const std::string& payload, const std::string& quotedKey,
+                          size_t* from) {
+  size_t n = payload.size();
+  size_t pos;
+  while ((pos = payload.find(quotedKey, *from)) != std::string::npos) {
+    size_t i = pos + quotedKey.size();
+    *from = pos + 1;
+    // A key preceded by a backslash is part of a string, not a key.
+    if (pos > 0 && payload[pos - 1] == '\\') {
+      continue;
+    }
+    while (i < n && isSpace(payload[i])) i++;
+    if (i == n || payload[i] != ':') {
+      continue;
+    }
+    i++;
+    while (i < n && isSpace(payload[i])) i++;
+    return i;
+  }
+  return std::string::npos;
+}
+
+// Look for `quotedKey` followed by a colon, and if hasValue, a value that is
+// either the string `value` (compared without decoding escapes) or the bare
+// literal `value`, like a number or true.
+static bool jsonMatch(const std::string& payload, const std::string& quotedKey,
+                      bool hasValue, const std::string& value) {
+  size_t n = payload.size();
+  size_t from = 0;
+  size_t i;
+  while ((i = findJsonKey(payload, quotedKey, &from)) != std::string::npos) {
+    if (!hasValue) {
+      return true;
+    }
+    if (i < n && payload[i] == '"') {
+      i++;
+      if (n - i > value.size() &&
+          payload.compare(i, value.size(), value) == 0 &&
+          payload[i + value.size()] == '"') {
+        return true;
+      }
+    } else if (n - i >= value.size() && payload.compare(i, value.size(), value) == 0) {
+      size_t end = i + value.size();
+      if (end == n || isLiteralEnd(payload[end])) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+MessageFilter::rule_ptr MessageFilter::match(const std::string& payload) const {
+  shared_ptr<const std::vector<rule_ptr>> current;
+  {
+    lock_guard<mutex> lock(rulesMutex);
+    current = rules;
+  }
+  for (size_t i = 0; i < current->size(); i++) {
+    const rule_ptr& rule = (*current)[i];
+    bool matched = false;
+    switch (rule->type) {
+    case MATCH_ALL:
+      matched = true;
+      break;
+    case MATCH_PREFIX:
+      matched = payload.size() >= rule->pattern.size() &&
+        payload.compare(0, rule->pattern.size(), rule->pattern) == 0;
+      break;
+    case MATCH_CONTAINS:
+      matched = payload.find(rule->pattern) != std::string::npos;
+      break;
+    case MATCH_JSON:
+      matched = jsonMatch(payload, rule->pattern, rule->hasValue, rule->value);
+      break;
+    }
+    if (matched) {
+      return rule;
+    }
+  }
+  return rule_ptr();
+}
+
+const size_t ConflationKey::maxRegexBytes;
+
+ConflationKey::ConflationKey(KeyType type, const std::string& pattern,
+                             size_t start, size_t length)
+  : type(type), pattern(pattern), start(start), length(length)
+{
+  if (type == KEY_JSON) {
+    this->pattern = "\"" + pattern + "\"";
+  } else if (type == KEY_REGEX) {
+    regex.assign(pattern, std::regex::ECMAScript | std::regex::optimize);
+  }
+}
+
+bool ConflationKey::extract(const std::string& payload, std::string* key) const {
+  switch (type) {
+  case KEY_BYTES:
+    if (payload.size() < start + length) {
+      return false;
+    }
+    key->assign(payload, start, length);
+    return true;
+
+  case KEY_JSON: {
+    size_t n = payload.size();
+    size_t from = 0;
+    size_t i = findJsonKey(payload, pattern, &from);
+    if (i == std::string::npos || i == n) {
+      return false;
+    }
+    size_t end = i;
+    if (payload[i] == '"') {
+      // Find the closing quote, skipping escaped characters. The key is the
+      // string's contents, with escapes left as they are.
+      i++;
+      for (end = i; end < n && payload[end] != '"'; end++) {
+        if (payload[end] == '\\') end++;
+      }
+      if (end >= n) {
+        return false;
+      }
+    } else {
+      while (end < n && !isLiteralEnd(payload[end])) end++;
+      // Objects and arrays can't be keys.
+      if (end == i || payload[i] == '{' || payload[i] == '[') {
+        return false;
+      }
+    }
+    key->assign(payload, i, end - i);
+    return true;
+  }
+
+  case KEY_REGEX: {
+    std::string::const_iterator end =
+      payload.begin() + std::min(payload.size(), maxRegexBytes);
+    std::smatch m;
+    try {
+      if (!std::regex_search(payload.begin(), end, m, regex)) {
+        return false;
+      }
+    } catch (const std::regex_error&) {
+      // The match was too complex.
+      return false;
+    }
+    // The first group, if there is one, or else the whole match.
+    const std::ssub_match& part = m.size() > 1 ? m[1] : m[0];
+    key->assign(part.first, part.second);
+    return true;
+  }
+  }
+  return false;
+}
@@ -0,0 +1,92 @@
+#ifndef FILTER_HPP
+#define FILTER_HPP
+
+#include "websocket_defs.h"
+#include <regex>
+#include <string>
+#include <vector>
+
+// Rules that decide what happens to each incoming message before it is
+// passed to R. Rules are added and removed on the main thread and matched on
+// the background thread. The first rule that matches a message either drops
+// it, so it never leaves the background thread, or routes it to the callbacks
+// for a topic. Messages that match no rule are delivered as usual.
+//
+// Matching works on the raw payload, without parsing it.
+class MessageFilter {
+public:
+  enum MatchType {
+    MATCH_ALL,       // Every message
+    MATCH_PREFIX,    // The payload starts with `pattern`
+    MATCH_CONTAINS,  // The payload contains `pattern`
+    MATCH_JSON       // The payload has a JSON key `pattern`, anywhere, and
+                     // if hasValue, its value is the string or literal `value`
+  };
+
+  struct Rule {
+    int id;
+    MatchType type;
+    std::string pattern;
+    bool hasValue;
+    std::string value;
+    bool drop;
+    std::string topic;
+  };
+  typedef shared_ptr<const Rule> rule_ptr;
+
+  MessageFilter() : rules(make_shared<std::vector<rule_ptr>>()) {}
+
+  // Add a rule after the existing ones. Returns its id, for remove(). The
+  // rule's id is ignored.
+  int add(Rule rule);
+  void remove(int id);
+
+  // Returns the first rule that matches the payload, or an empty pointer if
+  // none do.
+  rule_ptr match(const std::string& payload) const;
+
+private:
+  // Replaced as a whole, under rulesMutex, when a rule is added or removed,
+  // so that match() only needs the lock to copy the pointer.
+  mutable mutex rulesMutex;
+  shared_ptr<const std::vector<rule_ptr>> rules;
+  int nextId = 1;
+};
+
+// Picks out the key of a message, for last-value conflation: when messages
+// with the same key are waiting to be passed to R, only the newest is kept.
+// Like MessageFilter, this works on the raw payload. It's created on the main
+// thread before connecting, and then only used on the background thread.
+class ConflationKey {
+public:
+  enum KeyType {
+    KEY_BYTES,  // `length` bytes starting at byte `start`
+    KEY_JSON,   // The value of the first JSON key `pattern`, if it's a string
+                // (without the quotes) or a literal, like a number
+    KEY_REGEX   // The first group matched by the regex `pattern`, or the
+                // whole match if it has no groups, in the first
+                // maxRegexBytes of the payload
+  };
+
+  // std::regex is slow, and its matcher recurses for each character, so
+  // running it on a whole large payload could overflow the I/O thread's
+  // stack. Regex keys are only looked for in this many bytes at the start of
+  // each message.
+  static const size_t maxRegexBytes = 1024;
+
+  // Throws std::regex_error if `pattern` is not a valid regex.
+  ConflationKey(KeyType type, const std::string& pattern, size_t start, size_t length);
+
+  // Returns false if the payload has no key, in which case it shouldn't be
+  // conflated with anything.
+  bool extract(const std::string& payload, std::string* key) const;
+
+private:
+  KeyType type;
+  std::string pattern;
+  size_t start;
+  size_t length;
+  std::regex regex;
+};
+
+#endif
@@ -0,0 +1,70 @@
+#include <R_ext/Rdynload.h>
+#include "io_pool.h"
+#include "debug.h"
+
+IoPool& IoPool::instance() {
+  // Intentionally never deleted: destroying joinable threads during static
+  // destruction at process exit would call std::terminate().
+  static IoPool* pool = new IoPool();
+  return *pool;
+}
+
+io_service_t& IoPool::acquire(int nThreads) {
+  lock_guard<mutex> lock(poolMutex);
+  if (!threads.empty()) {
+    return io_service;
+  }
+
+  if (nThreads <= 0) {
+    nThreads = ws_websocketpp::lib::thread::hardware_concurrency();
+    if (nThreads <= 0) {
+      nThreads = 1;
+    }
+  }
+
+  // Keep run() from returning when there are no open connections.
+  io_service.reset();
+  work = make_shared<io_service_t::work>(io_service);
+  for (int i = 0; i < nThreads; i++) {
+    threads.push_back(make_shared<ws_websocketpp::lib::thread>(bind(&IoPool::run, this)));
+  }
+  return io_service;
+}
+
+std::size_t IoPool::size() {
+  lock_guard<mutex> lock(poolMutex);
+  return threads.size();
+}
+
+void IoPool::shutdown() {
+  lock_guard<mutex> lock(poolMutex);
+  if (threads.empty()) {
+    return;
+  }
+  work.reset();
+  io_service.stop();
+  for (std::size_t i = 0; i < threads.size(); i++) {
+    threads[i]->join();
+  }
+  threads.clear();
+}
+
+void IoPool::run() {
+  REGISTER_BACKGROUND_THREAD()
+  // An exception escaping from one connection's handler shouldn't take down
+  // the I/O for all of the other connections.
+  while (true) {
+    try {
+      io_service.run();
+      return;
+    } catch (const std::exception& e) {
+      err_printf("websocket: error in shared I/O thread: %s\n", e.what());
+    }
+  }
+}
+
+// Called by R when the package's shared library is unloaded. The I/O threads
+// must be stopped before their code is unmapped.
+extern "C" void R_unload_websocket(DllInfo*) {
+  IoPool::instance().shutdown();
+}
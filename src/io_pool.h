@@ -0,0 +1,45 @@
+#ifndef IO_POOL_HPP
+#define IO_POOL_HPP
+
+#include "websocket_defs.h"
+#include <vector>
+
+typedef ws_websocketpp::lib::asio::io_service io_service_t;
+
+// IoPool is a process-wide io_service that is shared by all WebSocket
+// connections created with sharedIo=TRUE. Instead of each connection running
+// its own io_service on its own thread (see WebsocketTask), a fixed number of
+// background threads run this one io_service, and they multiplex the I/O for
+// all of the shared connections.
+//
+// The threads are started the first time the pool is used, and are stopped
+// when the package's shared library is unloaded.
+class IoPool {
+public:
+  static IoPool& instance();
+
+  // Returns the shared io_service, starting the I/O threads if they aren't
+  // already running. If nThreads is 0, one thread per core is started. The
+  // number of threads is fixed once the pool has started.
+  io_service_t& acquire(int nThreads);
+
+  // Number of running I/O threads.
+  std::size_t size();
+
+  // Stop the io_service and join all of the I/O threads.
+  void shutdown();
+
+private:
+  IoPool() {}
+  IoPool(const IoPool&) = delete;
+  IoPool& operator=(const IoPool&) = delete;
+
+  void run();
+
+  mutex poolMutex;
+  io_service_t io_service;
+  shared_ptr<io_service_t::work> work;
+  std::vector<shared_ptr<ws_websocketpp::lib::thread>> threads;
+};
+
+#endif
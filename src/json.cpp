@@ -0,0 +1,536 @@
+#include "json.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define JSON_SSE2
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define JSON_NEON
+#endif
+
+namespace {
+
+// Nesting deeper than this is rejected, so that the recursive parser and
+// converter can't overflow the stack.
+const int maxDepth = 512;
+
+// Skip over the bytes of a string that need no special handling: anything
+// other than a quote, a backslash, or a control character. Checks 16 bytes at
+// a time with SSE2 or NEON where available.
+inline const char* skipPlain(const char* p, const char* end) {
+#if defined(JSON_SSE2)
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i backslash = _mm_set1_epi8('\\');
+  const __m128i control = _mm_set1_epi8(0x1F);
+  while (end - p >= 16) {
+    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    __m128i special = _mm_or_si128(
+      _mm_or_si128(_mm_cmpeq_epi8(x, quote), _mm_cmpeq_epi8(x, backslash)),
+      // Unsigned x <= 0x1F
+      _mm_cmpeq_epi8(_mm_max_epu8(x, control), control)
+    );
+    int mask = _mm_movemask_epi8(special);
+    if (mask != 0) {
+      int i = 0;
+      while (!(mask & 1)) {
+        mask >>= 1;
+        i++;
+      }
+      return p + i;
+    }
+    p += 16;
+  }
+#elif defined(JSON_NEON)
+  const uint8x16_t quote = vdupq_n_u8('"');
+  const uint8x16_t backslash = vdupq_n_u8('\\');
+  const uint8x16_t control = vdupq_n_u8(0x1F);
+  while (end - p >= 16) {
+    uint8x16_t x = vld1q_u8(reinterpret_cast<const uint8_t*>(p));
+    uint8x16_t special = vorrq_u8(
+      vorrq_u8(vceqq_u8(x, quote), vceqq_u8(x, backslash)),
+      vcleq_u8(x, control)
+    );
+    if (vmaxvq_u8(special) != 0) {
+      break;
+    }
+    p += 16;
+  }
+#endif
+  while (p < end) {
+    unsigned char c = *p;
+    if (c == '"' || c == '\\' || c < 0x20) {
+      break;
+    }
+    p++;
+  }
+  return p;
+}
+
+// Powers of ten that are exactly representable as doubles.
+const double exactPowers[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+class JsonParser {
+public:
+  JsonParser(JsonDocument& doc, const char* data, size_t len)
+    : doc(doc), start(data), p(data), end(data + len) {}
+
+  std::string error;
+
+  bool parse() {
+    skipSpace();
+    if (!value(0)) {
+      return false;
+    }
+    skipSpace();
+    if (p != end) {
+      return fail("unexpected data after value");
+    }
+    return true;
+  }
+
+private:
+  JsonDocument& doc;
+  const char* start;
+  const char* p;
+  const char* end;
+
+  bool fail(const char* message) {
+    doc.nodes.clear();
+    doc.strings.clear();
+    char position[32];
+    snprintf(position, sizeof(position), " at byte %lu", (unsigned long)(p - start));
+    error = message;
+    error += position;
+    return false;
+  }
+
+  void skipSpace() {
+    while (p < end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t')) {
+      p++;
+    }
+  }
+
+  size_t addNode(JsonDocument::Type type) {
+    JsonDocument::Node node;
+    node.type = type;
+    node.size = 0;
+    node.next = doc.nodes.size() + 1;
+    node.number = 0;
+    doc.nodes.push_back(node);
+    return doc.nodes.size() - 1;
+  }
+
+  bool literal(const char* word, size_t len, JsonDocument::Type type) {
+    if ((size_t)(end - p) < len || std::memcmp(p, word, len) != 0) {
+      return fail("invalid literal");
+    }
+    p += len;
+    addNode(type);
+    return true;
+  }
+
+  bool value(int depth) {
+    if (p == end) {
+      return fail("unexpected end of input");
+    }
+    switch (*p) {
+    case '{': return object(depth + 1);
+    case '[': return array(depth + 1);
+    case '"': return string();
+    case 't': return literal("true", 4, JsonDocument::JSON_TRUE);
+    case 'f': return literal("false", 5, JsonDocument::JSON_FALSE);
+    case 'n': return literal("null", 4, JsonDocument::JSON_NULL);
+    default: return number();
+    }
+  }
+
+  bool array(int depth) {
+    if (depth > maxDepth) {
+      return fail("nesting too deep");
+    }
+    size_t i = addNode(JsonDocument::JSON_ARRAY);
+    size_t count = 0;
+    p++;
+    skipSpace();
+    if (p < end && *p == ']') {
+      p++;
+    } else {
+      while (true) {
+        skipSpace();
+        if (!value(depth)) {
+          return false;
+        }
+        count++;
+        skipSpace();
+        if (p < end && *p == ',') {
+          p++;
+        } else if (p < end && *p == ']') {
+          p++;
+          break;
+        } else {
+          return fail("expected ',' or ']'");
+        }
+      }
+    }
+    doc.nodes[i].size = count;
+    doc.nodes[i].next = doc.nodes.size();
+    return true;
+  }
+
+  bool object(int depth) {
+    if (depth > maxDepth) {
+      return fail("nesting too deep");
+    }
+    size_t i = addNode(JsonDocument::JSON_OBJECT);
+    size_t count = 0;
+    p++;
+    skipSpace();
+    if (p < end && *p == '}') {
+      p++;
+    } else {
+      while (true) {
+        skipSpace();
+        if (p == end || *p != '"') {
+          return fail("expected string key");
+        }
+        if (!string()) {
+          return false;
+        }
+        skipSpace();
+        if (p == end || *p != ':') {
+          return fail("expected ':'");
+        }
+        p++;
+        skipSpace();
+        if (!value(depth)) {
+          return false;
+        }
+        count++;
+        skipSpace();
+        if (p < end && *p == ',') {
+          p++;
+        } else if (p < end && *p == '}') {
+          p++;
+          break;
+        } else {
+          return fail("expected ',' or '}'");
+        }
+      }
+    }
+    doc.nodes[i].size = count;
+    doc.nodes[i].next = doc.nodes.size();
+    return true;
+  }
+
+  static int hexDigit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+  }
+
+  bool hex4(unsigned* out) {
+    if (end - p < 4) {
+      return fail("invalid \\u escape");
+    }
+    unsigned v = 0;
+    for (int k = 0; k < 4; k++) {
+      int d = hexDigit(p[k]);
+      if (d < 0) {
+        return fail("invalid \\u escape");
+      }
+      v = (v << 4) | d;
+    }
+    p += 4;
+    *out = v;
+    return true;
+  }
+
+  void appendUtf8(unsigned cp) {
+    std::string& s = doc.strings;
+    if (cp < 0x80) {
+      s += (char)cp;
+    } else if (cp < 0x800) {
+      s += (char)(0xC0 | (cp >> 6));
+      s += (char)(0x80 | (cp & 0x3F));
+    } else if (cp < 0x10000) {
+      s += (char)(0xE0 | (cp >> 12));
+      s += (char)(0x80 | ((cp >> 6) & 0x3F));
+      s += (char)(0x80 | (cp & 0x3F));
+    } else {
+      s += (char)(0xF0 | (cp >> 18));
+      s += (char)(0x80 | ((cp >> 12) & 0x3F));
+      s += (char)(0x80 | ((cp >> 6) & 0x3F));
+      s += (char)(0x80 | (cp & 0x3F));
+    }
+  }
+
+  bool string() {
+    size_t i = addNode(JsonDocument::JSON_STRING);
+    size_t offset = doc.strings.size();
+    p++;
+    while (true) {
+      const char* run = p;
+      p = skipPlain(p, end);
+      doc.strings.append(run, p - run);
+      if (p == end) {
+        return fail("unterminated string");
+      }
+      char c = *p;
+      if (c == '"') {
+        p++;
+        break;
+      }
+      if (c != '\\') {
+        return fail("control character in string");
+      }
+      p++;
+      if (p == end) {
+        return fail("unterminated string");
+      }
+      c = *p++;
+      switch (c) {
+      case '"': doc.strings += '"'; break;
+      case '\\': doc.strings += '\\'; break;
+      case '/': doc.strings += '/'; break;
+      case 'b': doc.strings += '\b'; break;
+      case 'f': doc.strings += '\f'; break;
+      case 'n': doc.strings += '\n'; break;
+      case 'r': doc.strings += '\r'; break;
+      case 't': doc.strings += '\t'; break;
+      case 'u': {
+        unsigned cp;
+        if (!hex4(&cp)) {
+          return false;
+        }
+        if (cp >= 0xD800 && cp < 0xDC00) {
+          unsigned low;
+          if (end - p < 2 || p[0] != '\\' || p[1] != 'u') {
+            return fail("unpaired surrogate in \\u escape");
+          }
+          p += 2;
+          if (!hex4(&low)) {
+            return false;
+          }
+          if (low < 0xDC00 || low >= 0xE000) {
+            return fail("unpaired surrogate in \\u escape");
+          }
+          cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+        } else if (cp >= 0xDC00 && cp < 0xE000) {
+          return fail("unpaired surrogate in \\u escape");
+        } else if (cp == 0) {
+          // R strings can't contain NUL.
+          return fail("\\u0000 in string");
+        }
+        appendUtf8(cp);
+        break;
+      }
+      default:
+        return fail("invalid escape in string");
+      }
+    }
+    doc.nodes[i].offset = offset;
+    doc.nodes[i].size = doc.strings.size() - offset;
+    return true;
+  }
+
+  bool number() {
+    const char* numStart = p;
+    bool negative = false;
+    if (*p == '-') {
+      negative = true;
+      p++;
+    }
+    if (p == end || *p < '0' || *p > '9') {
+      return fail("invalid value");
+    }
+    // Collect up to 19 significant digits; if there are more, or the result
+    // can't be computed exactly, fall back to strtod().
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    if (*p == '0') {
+      p++;
+    } else {
+      while (p < end && *p >= '0' && *p <= '9') {
+        if (digits < 19) {
+          mantissa = mantissa * 10 + (*p - '0');
+          digits++;
+        } else {
+          exponent++;
+        }
+        p++;
+      }
+    }
+    if (p < end && *p == '.') {
+      p++;
+      if (p == end || *p < '0' || *p > '9') {
+        return fail("invalid number");
+      }
+      while (p < end && *p >= '0' && *p <= '9') {
+        if (digits < 19) {
+          mantissa = mantissa * 10 + (*p - '0');
+          if (mantissa != 0) digits++;
+          exponent--;
+        }
+        p++;
+      }
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+      p++;
+      bool expNegative = false;
+      if (p < end && (*p == '+' || *p == '-')) {
+        expNegative = *p == '-';
+        p++;
+      }
+      if (p == end || *p < '0' || *p > '9') {
+        return fail("invalid number");
+      }
+      int e = 0;
+      while (p < end && *p >= '0' && *p <= '9') {
+        if (e < 100000) e = e * 10 + (*p - '0');
+        p++;
+      }
+      exponent += expNegative ? -e : e;
+    }
+
+    double value;
+    if (mantissa < (uint64_t(1) << 53) && exponent >= -22 && exponent <= 22) {
+      // Both the mantissa and the power of ten are exact, so a single
+      // multiplication or division is correctly rounded.
+      value = (double)mantissa;
+      value = exponent < 0 ? value / exactPowers[-exponent] : value * exactPowers[exponent];
+      if (negative) value = -value;
+    } else {
+      std::string text(numStart, p - numStart);
+      value = std::strtod(text.c_str(), NULL);
+    }
+    size_t i = addNode(JsonDocument::JSON_NUMBER);
+    doc.nodes[i].number = value;
+    return true;
+  }
+};
+
+// The type of atomic vector an array can be simplified to, or NILSXP if it
+// can't be.
+SEXPTYPE simpleType(const JsonDocument& doc, size_t i) {
+  const JsonDocument::Node& array = doc.nodes[i];
+  if (array.size == 0) {
+    return NILSXP;
+  }
+  bool any = false;
+  JsonDocument::Type type = JsonDocument::JSON_NULL;
+  size_t j = i + 1;
+  for (size_t k = 0; k < array.size; k++) {
+    JsonDocument::Type t = doc.nodes[j].type;
+    if (t == JsonDocument::JSON_TRUE) {
+      t = JsonDocument::JSON_FALSE;
+    }
+    if (t == JsonDocument::JSON_ARRAY || t == JsonDocument::JSON_OBJECT) {
+      return NILSXP;
+    }
+    if (t != JsonDocument::JSON_NULL) {
+      if (any && t != type) {
+        return NILSXP;
+      }
+      type = t;
+      any = true;
+    }
+    j = doc.nodes[j].next;
+  }
+  switch (type) {
+  case JsonDocument::JSON_NUMBER: return REALSXP;
+  case JsonDocument::JSON_STRING: return STRSXP;
+  default: return LGLSXP;  // Booleans, or all null
+  }
+}
+
+SEXP makeString(const JsonDocument& doc, const JsonDocument::Node& node) {
+  return Rf_mkCharLenCE(doc.strings.data() + node.offset, node.size, CE_UTF8);
+}
+
+// Uses the R API directly, inside cpp11::unwind_protect(). Nothing here has
+// a destructor, so an R error can safely jump out of it.
+SEXP convert(const JsonDocument& doc, size_t i, bool simplify) {
+  const JsonDocument::Node& node = doc.nodes[i];
+  switch (node.type) {
+  case JsonDocument::JSON_NULL:
+    return R_NilValue;
+  case JsonDocument::JSON_FALSE:
+    return Rf_ScalarLogical(0);
+  case JsonDocument::JSON_TRUE:
+    return Rf_ScalarLogical(1);
+  case JsonDocument::JSON_NUMBER:
+    return Rf_ScalarReal(node.number);
+  case JsonDocument::JSON_STRING:
+    return Rf_ScalarString(makeString(doc, node));
+
+  case JsonDocument::JSON_ARRAY: {
+    SEXPTYPE type = simplify ? simpleType(doc, i) : NILSXP;
+    SEXP result = PROTECT(Rf_allocVector(type == NILSXP ? VECSXP : type, node.size));
+    size_t j = i + 1;
+    for (size_t k = 0; k < node.size; k++) {
+      const JsonDocument::Node& elt = doc.nodes[j];
+      bool null = elt.type == JsonDocument::JSON_NULL;
+      switch (type) {
+      case LGLSXP:
+        LOGICAL(result)[k] = null ? NA_LOGICAL : elt.type == JsonDocument::JSON_TRUE;
+        break;
+      case REALSXP:
+        REAL(result)[k] = null ? NA_REAL : elt.number;
+        break;
+      case STRSXP:
+        SET_STRING_ELT(result, k, null ? NA_STRING : makeString(doc, elt));
+        break;
+      default:
+        SET_VECTOR_ELT(result, k, convert(doc, j, simplify));
+      }
+      j = elt.next;
+    }
+    UNPROTECT(1);
+    return result;
+  }
+
+  case JsonDocument::JSON_OBJECT: {
+    SEXP result = PROTECT(Rf_allocVector(VECSXP, node.size));
+    SEXP names = PROTECT(Rf_allocVector(STRSXP, node.size));
+    size_t j = i + 1;
+    for (size_t k = 0; k < node.size; k++) {
+      SET_STRING_ELT(names, k, makeString(doc, doc.nodes[j]));
+      j = doc.nodes[j].next;
+      SET_VECTOR_ELT(result, k, convert(doc, j, simplify));
+      j = doc.nodes[j].next;
+    }
+    Rf_setAttrib(result, R_NamesSymbol, names);
+    UNPROTECT(2);
+    return result;
+  }
+  }
+  return R_NilValue;
+}
+
+} // namespace
+
+bool JsonDocument::parse(const char* data, size_t len) {
+  nodes.clear();
+  strings.clear();
+  parseError.clear();
+  JsonParser parser(*this, data, len);
+  if (!parser.parse()) {
+    parseError = parser.error;
+    return false;
+  }
+  return true;
+}
+
+cpp11::sexp jsonToR(const JsonDocument& doc, bool simplifyVector) {
+  return cpp11::unwind_protect([&] {
+    return convert(doc, 0, simplifyVector);
+  });
+}
@@ -0,0 +1,53 @@
+#ifndef JSON_HPP
+#define JSON_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "cpp11.hpp"
+
+// A parsed JSON document. Parsing does not touch R, so it can be done on a
+// background thread; jsonToR() then builds the R object on the main thread
+// with no further scanning of the text.
+//
+// Values are stored in document order as a flat array of nodes. An array or
+// object node is followed by its elements (for objects, alternating key and
+// value nodes), and `next` gives the index just past the node and all of its
+// elements. String contents, with escapes decoded, are stored in `strings`.
+class JsonDocument {
+public:
+  enum Type : uint8_t { JSON_NULL, JSON_FALSE, JSON_TRUE, JSON_NUMBER, JSON_STRING, JSON_ARRAY, JSON_OBJECT };
+
+  struct Node {
+    Type type;
+    // Number of elements for arrays, number of key-value pairs for objects,
+    // and length in bytes for strings.
+    size_t size;
+    size_t next;
+    union {
+      double number;
+      // Offset of a string's contents in `strings`.
+      size_t offset;
+    };
+  };
+
+  // Returns false if the text is not valid JSON, in which case error() says
+  // why and where.
+  bool parse(const char* data, size_t len);
+  const std::string& error() const { return parseError; }
+
+  std::vector<Node> nodes;
+  std::string strings;
+
+private:
+  std::string parseError;
+};
+
+// Convert a parsed document to R. Objects become named lists, arrays become
+// lists, and numbers become doubles. With simplifyVector, arrays in which
+// every element is a scalar of the same type (or null) become atomic
+// vectors, with NA for null. Call on the main thread.
+cpp11::sexp jsonToR(const JsonDocument& doc, bool simplifyVector);
+
+#endif
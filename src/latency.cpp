@@ -0,0 +1,37 @@
+#include "latency.h"
+#include <algorithm>
+#include <cmath>
+
+void LatencyStats::add(double ms) {
+  lock_guard<mutex> lock(statsMutex);
+  samples[count % window] = ms;
+  if (count == 0 || ms < min) {
+    min = ms;
+  }
+  count++;
+  sum += ms;
+  last = ms;
+}
+
+LatencyStats::Summary LatencyStats::summary() {
+  std::vector<double> recent;
+  Summary s;
+  {
+    lock_guard<mutex> lock(statsMutex);
+    s.count = count;
+    if (count == 0) {
+      s.last = s.min = s.mean = s.p99 = NAN;
+      return s;
+    }
+    s.last = last;
+    s.min = min;
+    s.mean = sum / count;
+    recent.assign(samples.begin(), samples.begin() + std::min<uint64_t>(count, window));
+  }
+
+  // Nearest-rank percentile.
+  size_t rank = static_cast<size_t>(std::ceil(0.99 * recent.size()));
+  std::nth_element(recent.begin(), recent.begin() + (rank - 1), recent.end());
+  s.p99 = recent[rank - 1];
+  return s;
+}
@@ -0,0 +1,41 @@
+#ifndef LATENCY_HPP
+#define LATENCY_HPP
+
+#include "websocket_defs.h"
+#include <cstdint>
+#include <vector>
+
+// Round trip times measured with keepalive pings. add() is called on the
+// background thread, and summary() on the main thread.
+//
+// The minimum and mean are over all samples, and the 99th percentile is over
+// the most recent `window` samples.
+class LatencyStats {
+public:
+  struct Summary {
+    double last;
+    double min;
+    double mean;
+    double p99;
+    uint64_t count;
+  };
+
+  LatencyStats() : samples(window) {}
+
+  // Record a round trip time, in milliseconds.
+  void add(double ms);
+
+  Summary summary();
+
+private:
+  static const size_t window = 1000;
+
+  mutex statsMutex;
+  std::vector<double> samples;  // Ring buffer of the last `window` samples
+  uint64_t count = 0;
+  double sum = 0;
+  double min = 0;
+  double last = 0;
+};
+
+#endif
@@ -21,3 +21,4 @@ rm -rf websocketpp_repo
 
 echo "IMPORTANT NOTE: Apply this patch manually:" >&2
 echo "https://github.com/rstudio/websocket/commit/063ca452c7639b952dfd4981602436d43305457a" >&2
+echo "Then re-apply the local changes listed in src/README.md." >&2
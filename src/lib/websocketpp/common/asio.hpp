@@ -88,6 +88,9 @@ namespace lib {
         inline lib::chrono::milliseconds milliseconds(long duration) {
             return lib::chrono::milliseconds(duration);
         }
+        inline lib::chrono::microseconds microseconds(long duration) {
+            return lib::chrono::microseconds(duration);
+        }
     } // namespace asio
     
 #else
@@ -109,10 +112,16 @@ namespace lib {
                 inline std::chrono::milliseconds milliseconds(long duration) {
                     return std::chrono::milliseconds(duration);
                 }
+                inline std::chrono::microseconds microseconds(long duration) {
+                    return std::chrono::microseconds(duration);
+                }
             #else
                 inline lib::chrono::milliseconds milliseconds(long duration) {
                     return lib::chrono::milliseconds(duration);
                 }
+                inline lib::chrono::microseconds microseconds(long duration) {
+                    return lib::chrono::microseconds(duration);
+                }
             #endif
         #else
             // Using boost::asio <1.49 we pretend a deadline timer is a steady
@@ -127,6 +136,9 @@ namespace lib {
             inline boost::posix_time::time_duration milliseconds(long duration) {
                 return boost::posix_time::milliseconds(duration);
             }
+            inline boost::posix_time::time_duration microseconds(long duration) {
+                return boost::posix_time::microseconds(duration);
+            }
         #endif
         
         using boost::system::error_code;
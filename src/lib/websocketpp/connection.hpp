@@ -37,6 +37,7 @@
 #include <websocketpp/transport/base/connection.hpp>
 #include <websocketpp/http/constants.hpp>
 
+#include <websocketpp/common/chrono.hpp>
 #include <websocketpp/common/connection_hdl.hpp>
 #include <websocketpp/common/cpp11.hpp>
 #include <websocketpp/common/functional.hpp>
@@ -90,6 +91,36 @@ typedef lib::function<void(connection_hdl)> fail_handler;
  */
 typedef lib::function<void(connection_hdl)> interrupt_handler;
 
+/// The type and function signature of a write complete handler
+/**
+ * The write complete handler is called after each transport write of one or
+ * more frames finishes successfully, with the number of frames written and how
+ * many of those were data (not control) frames. It is called without any
+ * connection locks held, so it may query the connection, e.g. with
+ * get_unsent_amount(). This is typically used to apply backpressure to the
+ * code that is sending messages.
+ */
+typedef lib::function<void(connection_hdl,size_t,size_t)>
+    write_complete_handler;
+
+/// The type and function signature of a read complete handler
+/**
+ * The read complete handler is called after the bytes from each transport read
+ * have been processed, with the number of frames that were completed. It is
+ * called after the handlers for any messages in those frames.
+ */
+typedef lib::function<void(connection_hdl,size_t)> read_complete_handler;
+
+/// The type and function signature of a read data handler
+/**
+ * The read data handler is called with the raw bytes from each transport read
+ * after the opening handshake, before they are processed. Bytes that arrived
+ * in the same read as the end of the handshake response are included. It can
+ * be used to record the frames a connection receives.
+ */
+typedef lib::function<void(connection_hdl,char const *,size_t)>
+    read_data_handler;
+
 /// The type and function signature of a ping handler
 /**
  * The ping handler is called when the connection receives a WebSocket ping
@@ -313,12 +344,22 @@ public:
       , m_close_handshake_timeout_dur(config::timeout_close_handshake)
       , m_pong_timeout_dur(config::timeout_pong)
       , m_max_message_size(config::max_message_size)
+      , m_stream_chunk_size(0)
       , m_state(session::state::connecting)
       , m_internal_state(session::internal_state::USER_INIT)
       , m_msg_manager(new con_msg_manager_type())
+      , m_keepalive_interval(0)
+      , m_keepalive_pending(false)
       , m_send_buffer_size(0)
+      , m_write_in_flight(0)
       , m_write_flag(false)
+      , m_write_max_bytes(0)
+      , m_write_max_frames(0)
+      , m_write_flush_delay(0)
+      , m_write_flush_generation(0)
+      , m_write_flush_now(false)
       , m_read_flag(true)
+      , m_read_pending(false)
       , m_is_server(p_is_server)
       , m_alog(alog)
       , m_elog(elog)
@@ -433,6 +474,40 @@ public:
         m_interrupt_handler = h;
     }
 
+    /// Set write complete handler
+    /**
+     * The write complete handler is called whenever a transport write
+     * finishes successfully. It is not called for the write of a terminal
+     * frame or for writes that fail.
+     *
+     * @param h The new write_complete_handler
+     */
+    void set_write_complete_handler(write_complete_handler h) {
+        m_write_complete_handler = h;
+    }
+
+    /// Set read complete handler
+    /**
+     * The read complete handler is called whenever the bytes from a transport
+     * read have been processed, unless processing them ended the connection.
+     *
+     * @param h The new read_complete_handler
+     */
+    void set_read_complete_handler(read_complete_handler h) {
+        m_read_complete_handler = h;
+    }
+
+    /// Set read data handler
+    /**
+     * The read data handler is called with the bytes from each transport read
+     * after the opening handshake, before they are processed.
+     *
+     * @param h The new read_data_handler
+     */
+    void set_read_data_handler(read_data_handler h) {
+        m_read_data_handler = h;
+    }
+
     /// Set http handler
     /**
      * The http handler is called after an HTTP request other than a WebSocket
@@ -547,6 +622,27 @@ public:
         m_pong_timeout_dur = dur;
     }
 
+    /// Set keepalive interval
+    /**
+     * Sends a ping every interval ms while the connection is open, to detect
+     * connections that have silently gone dead. A new ping is not sent until
+     * the previous one has been answered. If a ping goes unanswered for the
+     * pong timeout (see set_pong_timeout()), the pong timeout handler is
+     * called, and then the connection is terminated with error::pong_timeout.
+     *
+     * The payload of each keepalive ping is the time it was sent, as a decimal
+     * number of microseconds on lib::chrono::steady_clock. A pong handler can
+     * use this to measure round trip time.
+     *
+     * The transport must support timers. This must be set before the
+     * connection is opened. The default is 0, which disables keepalive.
+     *
+     * @param interval The time between pings in ms
+     */
+    void set_keepalive(long interval) {
+        m_keepalive_interval = interval;
+    }
+
     /// Get maximum message size
     /**
      * Get maximum message size. Maximum message size determines the point at 
@@ -578,6 +674,26 @@ public:
             m_processor->set_max_message_size(new_value);
         }
     }
+
+    /// Set the size of the parts that incoming data messages are delivered in
+    /**
+     * If nonzero, the message handler is called with each data message in
+     * parts as it arrives, instead of once with the whole message. Every
+     * part but the last has its fin flag cleared. The maximum message size
+     * does not apply to these messages. See
+     * processor::set_stream_chunk_size() for details.
+     *
+     * The default is 0, which delivers messages whole. This should be set
+     * before the connection is opened.
+     *
+     * @param new_value The chunk size in bytes, or 0 to deliver messages whole
+     */
+    void set_stream_chunk_size(size_t new_value) {
+        m_stream_chunk_size = new_value;
+        if (m_processor) {
+            m_processor->set_stream_chunk_size(new_value);
+        }
+    }
     
     /// Get maximum HTTP message body size
     /**
@@ -611,6 +727,40 @@ public:
         m_request.set_max_body_size(new_value);
     }
 
+    /// Set write coalescing limits
+    /**
+     * Each transport write gathers every frame that is waiting in the send
+     * queue into a single scatter-gather write. These settings bound how much
+     * goes into one write, and can delay a write briefly so that frames sent
+     * in quick succession share it.
+     *
+     * If max_bytes or max_frames is reached, the rest of the queue is left for
+     * the next write. A write always includes at least one frame. A value of 0
+     * means no limit.
+     *
+     * If flush_delay is nonzero, a write that would start on an idle
+     * connection is instead started flush_delay microseconds later, or as soon
+     * as the queued frames reach one of the limits. Writes that follow a
+     * completed write are not delayed, since frames have already had time to
+     * collect. The transport must support timers for the delay to take effect.
+     *
+     * The default is no limits and no delay.
+     *
+     * This method invokes the m_write_lock mutex
+     *
+     * @param max_bytes The most header and payload bytes in one write
+     * @param max_frames The most frames in one write
+     * @param flush_delay How long to wait before an idle write, in microseconds
+     */
+    void set_write_coalescing(size_t max_bytes, size_t max_frames,
+        long flush_delay)
+    {
+        scoped_lock_type lock(m_write_lock);
+        m_write_max_bytes = max_bytes;
+        m_write_max_frames = max_frames;
+        m_write_flush_delay = flush_delay;
+    }
+
     //////////////////////////////////
     // Uncategorized public methods //
     //////////////////////////////////
@@ -636,6 +786,19 @@ public:
         return get_buffered_amount();
     }
 
+    /// Get the number of payload bytes that have not been written yet
+    /**
+     * Like get_buffered_amount(), but also counts the payloads of frames that
+     * have been dispatched to the transport layer and whose write has not
+     * completed yet. This is the amount that the WebSocket API calls
+     * bufferedAmount.
+     *
+     * This method invokes the m_write_lock mutex
+     *
+     * @return The number of payload bytes that are queued or being written.
+     */
+    size_t get_unsent_amount() const;
+
     ////////////////////
     // Action Methods //
     ////////////////////
@@ -687,6 +850,22 @@ public:
      */
     lib::error_code send(message_ptr msg);
 
+    /// Add a batch of messages to the outgoing send queue
+    /**
+     * Equivalent to calling send(message_ptr) for each message in turn, except
+     * that the connection state is checked and m_write_lock is taken only once
+     * for the whole batch, and at most one write is started for it. The queued
+     * frames are then gathered into as few writes as possible.
+     *
+     * If a message fails validation, the messages before it remain queued, and
+     * the error is returned.
+     *
+     * This method invokes the m_write_lock mutex
+     *
+     * @param msgs The messages to send, in order.
+     */
+    lib::error_code send_many(std::vector<message_ptr> const & msgs);
+
     /// Asyncronously invoke handler::on_inturrupt
     /**
      * Signals to the connection to asyncronously invoke the on_inturrupt
@@ -728,6 +907,11 @@ public:
     lib::error_code pause_reading();
 
     /// Pause reading callback
+    /**
+     * Stops reading right away instead of asynchronously. This is safe to call
+     * only from within a handler for this connection, such as the message
+     * handler.
+     */
     void handle_pause_reading();
 
     /// Resume reading of new data
@@ -1301,6 +1485,8 @@ public:
 
     void handle_open_handshake_timeout(lib::error_code const & ec);
     void handle_close_handshake_timeout(lib::error_code const & ec);
+    void start_keepalive_timer();
+    void handle_keepalive_timer(lib::error_code const & ec);
 
     void handle_read_frame(lib::error_code const & ec, size_t bytes_transferred);
     void read_frame();
@@ -1336,6 +1522,15 @@ public:
      * non-zero otherwise.
      */
     void handle_write_frame(lib::error_code const & ec);
+
+    /// Start a write that was delayed by the write coalescing window
+    /**
+     * @param generation Identifies the timer that expired. Expiries of timers
+     * that have since been cancelled are ignored.
+     * @param ec The status of the timer
+     */
+    void handle_write_flush_timeout(size_t generation,
+        lib::error_code const & ec);
 // protected:
     // This set of methods would really like to be protected, but doing so 
     // requires that the endpoint be able to friend the connection. This is 
@@ -1455,6 +1650,12 @@ private:
      */
     message_ptr write_pop();
 
+    /// Whether the send queue has reached the write coalescing limits
+    /**
+     * Requires m_write_lock
+     */
+    bool write_budget_reached() const;
+
     /// Prints information about the incoming connection to the access log
     /**
      * Prints information about the incoming connection to the access log.
@@ -1507,6 +1708,9 @@ private:
     pong_handler            m_pong_handler;
     pong_timeout_handler    m_pong_timeout_handler;
     interrupt_handler       m_interrupt_handler;
+    write_complete_handler  m_write_complete_handler;
+    read_complete_handler   m_read_complete_handler;
+    read_data_handler       m_read_data_handler;
     http_handler            m_http_handler;
     validate_handler        m_validate_handler;
     message_handler         m_message_handler;
@@ -1516,6 +1720,7 @@ private:
     long                    m_close_handshake_timeout_dur;
     long                    m_pong_timeout_dur;
     size_t                  m_max_message_size;
+    size_t                  m_stream_chunk_size;
 
     /// External connection state
     /**
@@ -1536,7 +1741,7 @@ private:
      * Serializes access to the write queue as well as shared state within the
      * processor.
      */
-    mutex_type              m_write_lock;
+    mutable mutex_type      m_write_lock;
 
     // connection resources
     char                    m_buf[config::connection_read_buffer_size];
@@ -1546,6 +1751,12 @@ private:
     timer_ptr               m_handshake_timer;
     timer_ptr               m_ping_timer;
 
+    /// Keepalive state; see set_keepalive(). m_keepalive_pending is true while
+    /// a keepalive ping is waiting for a pong.
+    long                    m_keepalive_interval;
+    timer_ptr               m_keepalive_timer;
+    bool                    m_keepalive_pending;
+
     /// @todo this is not memory efficient. this value is not used after the
     /// handshake.
     std::string m_handshake_buffer;
@@ -1583,15 +1794,45 @@ private:
     /// from going out of scope before the write is complete.
     std::vector<message_ptr> m_current_msgs;
 
+    /// Size in bytes of the payloads in m_current_msgs
+    /**
+     * Lock m_write_lock
+     */
+    size_t m_write_in_flight;
+
     /// True if there is currently an outstanding transport write
     /**
      * Lock m_write_lock
      */
     bool m_write_flag;
 
+    /// Write coalescing limits; see set_write_coalescing()
+    /**
+     * Lock m_write_lock
+     */
+    size_t m_write_max_bytes;
+    size_t m_write_max_frames;
+    long m_write_flush_delay;
+
+    /// Pending timer for a write delayed by the coalescing window, if any
+    /**
+     * Lock m_write_lock
+     */
+    timer_ptr m_write_flush_timer;
+    size_t m_write_flush_generation;
+
+    /// True if the next write should start without a coalescing delay
+    /**
+     * Lock m_write_lock
+     */
+    bool m_write_flush_now;
+
     /// True if this connection is presently reading new data
     bool m_read_flag;
 
+    /// True if there is an outstanding transport read
+    bool m_read_pending;
+
     // connection data
     request_type            m_request;
     response_type           m_response;
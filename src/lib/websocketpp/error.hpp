@@ -143,7 +143,10 @@ enum value {
     http_parse_error,
     
     /// Extension negotiation failed
-    extension_neg_failed
+    extension_neg_failed,
+
+    /// A keepalive ping was not answered in time
+    pong_timeout
 }; // enum value
 
 
@@ -221,6 +224,8 @@ public:
                 return "HTTP parse error";
             case error::extension_neg_failed:
                 return "Extension negotiation failed";
+            case error::pong_timeout:
+                return "No pong received in response to keepalive ping";
             default:
                 return "Unknown";
         }
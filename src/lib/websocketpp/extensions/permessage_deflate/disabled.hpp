@@ -110,6 +110,17 @@ public:
         return make_error_code(error::disabled);
     }
 
+    /// Compress bytes from a buffer
+    /**
+     * @param [in] in Buffer to compress
+     * @param [in] len Length of the buffer
+     * @param [out] out String to append compressed bytes to
+     * @return Error or status code
+     */
+    lib::error_code compress(uint8_t const *, size_t, std::string &) {
+        return make_error_code(error::disabled);
+    }
+
     /// Decompress bytes
     /**
      * @param buf Byte buffer to decompress
@@ -546,20 +546,32 @@ public:
      * @return Error or status code
      */
     lib::error_code compress(std::string const & in, std::string & out) {
+        return compress(reinterpret_cast<uint8_t const *>(in.data()),
+            in.size(), out);
+    }
+
+    /// Compress bytes from a buffer
+    /**
+     * @param [in] in Buffer to compress
+     * @param [in] len Length of the buffer
+     * @param [out] out String to append compressed bytes to
+     * @return Error or status code
+     */
+    lib::error_code compress(uint8_t const * in, size_t len, std::string & out) {
         if (!m_initialized) {
             return make_error_code(error::uninitialized);
         }
 
         size_t output;
 
-        if (in.empty()) {
+        if (len == 0) {
             uint8_t buf[6] = {0x02, 0x00, 0x00, 0x00, 0xff, 0xff};
             out.append((char *)(buf),6);
             return lib::error_code();
         }
 
-        m_dstate.avail_in = in.size();
-        m_dstate.next_in = (unsigned char *)(const_cast<char *>(in.data()));
+        m_dstate.avail_in = len;
+        m_dstate.next_in = const_cast<unsigned char *>(in);
 
         do {
             // Output to local buffer
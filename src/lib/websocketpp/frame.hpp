@@ -29,6 +29,7 @@
 #define WEBSOCKETPP_FRAME_HPP
 
 #include <algorithm>
+#include <cstring>
 #include <string>
 
 #include <websocketpp/common/system_error.hpp>
@@ -36,6 +37,15 @@
 
 #include <websocketpp/utilities.hpp>
 
+#if (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#elif defined(_M_X64) || defined(_M_IX86)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
 namespace ws_websocketpp {
 /// Data structures and utility functions for manipulating WebSocket frames
 /**
@@ -312,6 +322,10 @@ void word_mask_exact(uint8_t * data, size_t length, masking_key_type const &
 size_t word_mask_circ(uint8_t * input, uint8_t * output, size_t length,
     size_t prepared_key);
 size_t word_mask_circ(uint8_t * data, size_t length, size_t prepared_key);
+void simd_mask(uint8_t const * input, uint8_t * output, size_t length,
+    masking_key_type const & key, size_t key_offset = 0);
+size_t simd_mask_circ(uint8_t const * input, uint8_t * output, size_t length,
+    size_t prepared_key);
 
 /// Check whether the frame's FIN bit is set.
 /**
@@ -678,6 +692,196 @@ void byte_mask(iter_type b, iter_type e, masking_key_type const & key,
     byte_mask(b,e,b,key,key_offset);
 }
 
+namespace simd {
+
+// Each kernel masks whole blocks of its vector width, starting at input[0],
+// with a key pattern that begins with the first byte of `pattern` (the key
+// replicated to 32 bytes). It returns the number of bytes masked; the caller
+// masks the tail. Since the block widths are multiples of 4, the key phase is
+// the same at the end of every block. Input and output may be the same buffer.
+
+#if (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__))
+
+/// Whether the CPU supports AVX2, checked once.
+inline bool have_avx2() {
+    static bool const result = __builtin_cpu_supports("avx2");
+    return result;
+}
+
+__attribute__((target("avx2")))
+inline size_t mask_avx2(uint8_t const * input, uint8_t * output,
+    size_t length, uint8_t const * pattern)
+{
+    __m256i const k = _mm256_loadu_si256(
+        reinterpret_cast<__m256i const *>(pattern));
+    size_t i = 0;
+    for (; i + 128 <= length; i += 128) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(input+i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(input+i+32));
+        __m256i c = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(input+i+64));
+        __m256i d = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(input+i+96));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(output+i), _mm256_xor_si256(a,k));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(output+i+32), _mm256_xor_si256(b,k));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(output+i+64), _mm256_xor_si256(c,k));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(output+i+96), _mm256_xor_si256(d,k));
+    }
+    for (; i + 32 <= length; i += 32) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(input+i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(output+i), _mm256_xor_si256(a,k));
+    }
+    return i;
+}
+
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define WEBSOCKETPP_SIMD_MASK_SSE2
+
+inline size_t mask_sse2(uint8_t const * input, uint8_t * output,
+    size_t length, uint8_t const * pattern)
+{
+    __m128i const k = _mm_loadu_si128(reinterpret_cast<__m128i const *>(pattern));
+    size_t i = 0;
+    for (; i + 64 <= length; i += 64) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<__m128i const *>(input+i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<__m128i const *>(input+i+16));
+        __m128i c = _mm_loadu_si128(reinterpret_cast<__m128i const *>(input+i+32));
+        __m128i d = _mm_loadu_si128(reinterpret_cast<__m128i const *>(input+i+48));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(output+i), _mm_xor_si128(a,k));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(output+i+16), _mm_xor_si128(b,k));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(output+i+32), _mm_xor_si128(c,k));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(output+i+48), _mm_xor_si128(d,k));
+    }
+    for (; i + 16 <= length; i += 16) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<__m128i const *>(input+i));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(output+i), _mm_xor_si128(a,k));
+    }
+    return i;
+}
+
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define WEBSOCKETPP_SIMD_MASK_NEON
+
+inline size_t mask_neon(uint8_t const * input, uint8_t * output,
+    size_t length, uint8_t const * pattern)
+{
+    uint8x16_t const k = vld1q_u8(pattern);
+    size_t i = 0;
+    for (; i + 64 <= length; i += 64) {
+        uint8x16_t a = vld1q_u8(input+i);
+        uint8x16_t b = vld1q_u8(input+i+16);
+        uint8x16_t c = vld1q_u8(input+i+32);
+        uint8x16_t d = vld1q_u8(input+i+48);
+        vst1q_u8(output+i, veorq_u8(a,k));
+        vst1q_u8(output+i+16, veorq_u8(b,k));
+        vst1q_u8(output+i+32, veorq_u8(c,k));
+        vst1q_u8(output+i+48, veorq_u8(d,k));
+    }
+    for (; i + 16 <= length; i += 16) {
+        vst1q_u8(output+i, veorq_u8(vld1q_u8(input+i),k));
+    }
+    return i;
+}
+
+#endif
+
+/// Portable fallback: 8 bytes at a time, using memcpy for unaligned access.
+inline size_t mask_words(uint8_t const * input, uint8_t * output,
+    size_t length, uint8_t const * pattern)
+{
+    uint64_t k;
+    std::memcpy(&k, pattern, sizeof(k));
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t w;
+        std::memcpy(&w, input+i, sizeof(w));
+        w ^= k;
+        std::memcpy(output+i, &w, sizeof(w));
+    }
+    return i;
+}
+
+/// Mask as much of the buffer as possible with the best available kernel.
+inline size_t mask_blocks(uint8_t const * input, uint8_t * output,
+    size_t length, uint8_t const * pattern)
+{
+#if (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__))
+    if (length >= 64 && have_avx2()) {
+        return mask_avx2(input, output, length, pattern);
+    }
+#endif
+#if defined(WEBSOCKETPP_SIMD_MASK_SSE2)
+    return mask_sse2(input, output, length, pattern);
+#elif defined(WEBSOCKETPP_SIMD_MASK_NEON)
+    return mask_neon(input, output, length, pattern);
+#else
+    return mask_words(input, output, length, pattern);
+#endif
+}
+
+} // namespace simd
+
+/// Vectorized mask/unmask
+/**
+ * Masks or unmasks `length` bytes of input into output, using SSE2 or AVX2
+ * (chosen at runtime) on x86, NEON on ARM, and 64-bit words elsewhere. No
+ * alignment is required. Input and output may be the same buffer; otherwise
+ * they must not overlap.
+ *
+ * @param input buffer to mask or unmask
+ *
+ * @param output buffer to store the output. Exactly length bytes are written.
+ *
+ * @param length length of the input
+ *
+ * @param key Masking key to use
+ *
+ * @param key_offset offset value to start masking at.
+ */
+inline void simd_mask(uint8_t const * input, uint8_t * output, size_t length,
+    masking_key_type const & key, size_t key_offset)
+{
+    uint8_t pattern[32];
+    for (size_t i = 0; i < sizeof(pattern); i++) {
+        pattern[i] = key.c[(key_offset + i) % 4];
+    }
+
+    size_t i = simd::mask_blocks(input, output, length, pattern);
+
+    for (; i < length; i++) {
+        output[i] = input[i] ^ pattern[i % 4];
+    }
+}
+
+/// Circular vectorized mask/unmask
+/**
+ * simd_mask() with the prepared key interface of byte_mask_circ. Returns the
+ * prepared key shifted to account for the length, which may be fed back in
+ * when more data is available.
+ *
+ * @param input buffer to mask or unmask
+ *
+ * @param output buffer to store the output. May be the same as input.
+ *
+ * @param length length of the input
+ *
+ * @param prepared_key Prepared key to use.
+ *
+ * @return the prepared_key shifted to account for the input length
+ */
+inline size_t simd_mask_circ(uint8_t const * input, uint8_t * output,
+    size_t length, size_t prepared_key)
+{
+    uint32_converter key;
+    key.i = static_cast<uint32_t>(prepared_key);
+
+    simd_mask(input, output, length, key, 0);
+
+    return circshift_prepared_key(prepared_key,length % 4);
+}
+
 /// Exact word aligned mask/unmask
 /**
  * Balanced combination of byte by byte and circular word by word masking.
@@ -702,18 +906,7 @@ void byte_mask(iter_type b, iter_type e, masking_key_type const & key,
 inline void word_mask_exact(uint8_t* input, uint8_t* output, size_t length,
     const masking_key_type& key)
 {
-    size_t prepared_key = prepare_masking_key(key);
-    size_t n = length/sizeof(size_t);
-    size_t* input_word = reinterpret_cast<size_t*>(input);
-    size_t* output_word = reinterpret_cast<size_t*>(output);
-
-    for (size_t i = 0; i < n; i++) {
-        output_word[i] = input_word[i] ^ prepared_key;
-    }
-
-    for (size_t i = n*sizeof(size_t); i < length; i++) {
-        output[i] = input[i] ^ key.c[i%4];
-    }
+    simd_mask(input,output,length,key,0);
 }
 
 /// Exact word aligned mask/unmask (in place)
@@ -768,24 +961,7 @@ inline void word_mask_exact(uint8_t* data, size_t length, const
 inline size_t word_mask_circ(uint8_t * input, uint8_t * output, size_t length,
     size_t prepared_key)
 {
-    size_t n = length / sizeof(size_t); // whole words
-    size_t l = length - (n * sizeof(size_t)); // remaining bytes
-    size_t * input_word = reinterpret_cast<size_t *>(input);
-    size_t * output_word = reinterpret_cast<size_t *>(output);
-
-    // mask word by word
-    for (size_t i = 0; i < n; i++) {
-        output_word[i] = input_word[i] ^ prepared_key;
-    }
-
-    // mask partial word at the end
-    size_t start = length - l;
-    uint8_t * byte_key = reinterpret_cast<uint8_t *>(&prepared_key);
-    for (size_t i = 0; i < l; ++i) {
-        output[start+i] = input[start+i] ^ byte_key[i];
-    }
-
-    return circshift_prepared_key(prepared_key,l);
+    return simd_mask_circ(input,output,length,prepared_key);
 }
 
 /// Circular word aligned mask/unmask (in place)
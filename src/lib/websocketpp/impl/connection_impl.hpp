@@ -73,6 +73,12 @@ size_t connection<config>::get_buffered_amount() const {
     return m_send_buffer_size;
 }
 
+template <typename config>
+size_t connection<config>::get_unsent_amount() const {
+    scoped_lock_type lock(m_write_lock);
+    return m_send_buffer_size + m_write_in_flight;
+}
+
 template <typename config>
 session::state::value connection<config>::get_state() const {
     //scoped_lock_type lock(m_connection_state_lock);
@@ -94,10 +100,59 @@ template <typename config>
 lib::error_code connection<config>::send(void const * payload, size_t len,
     frame::opcode::value op)
 {
-    message_ptr msg = m_msg_manager->get_message(op,len);
-    msg->append_payload(payload,len);
+    if (m_alog->static_test(log::alevel::devel)) {
+        m_alog->write(log::alevel::devel,"connection send (buffer)");
+    }
 
-    return send(msg);
+    {
+        scoped_lock_type lock(m_connection_state_lock);
+        if (m_state != session::state::open) {
+           return error::make_error_code(error::invalid_state);
+        }
+    }
+
+    // Frame the payload straight out of the caller's buffer, so that it is
+    // copied only once, into the outgoing message. Asking for the size up
+    // front lets a pooling message manager hand back a message that already
+    // has room for it.
+    message_ptr outgoing_msg = m_msg_manager->get_message(op,len);
+
+    if (!outgoing_msg) {
+        return error::make_error_code(error::no_outgoing_buffers);
+    }
+
+    bool needs_writing = false;
+    {
+        scoped_lock_type lock(m_write_lock);
+        lib::error_code ec = m_processor->prepare_data_frame_buffer(op,payload,
+            len,true,true,outgoing_msg);
+
+        if (ec == processor::error::make_error_code(
+            processor::error::not_implemented))
+        {
+            // Fall back to copying the payload into a message first.
+            message_ptr msg = m_msg_manager->get_message(op,len);
+            msg->append_payload(payload,len);
+            msg->set_compressed(true);
+            ec = m_processor->prepare_data_frame(msg,outgoing_msg);
+        }
+
+        if (ec) {
+            return ec;
+        }
+
+        write_push(outgoing_msg);
+        needs_writing = !m_write_flag && !m_send_queue.empty();
+    }
+
+    if (needs_writing) {
+        transport_con_type::dispatch(lib::bind(
+            &type::write_frame,
+            type::get_shared()
+        ));
+    }
+
+    return lib::error_code();
 }
 
 template <typename config>
@@ -124,7 +179,8 @@ lib::error_code connection<config>::send(typename config::message_type::ptr msg)
         write_push(outgoing_msg);
         needs_writing = !m_write_flag && !m_send_queue.empty();
     } else {
-        outgoing_msg = m_msg_manager->get_message();
+        outgoing_msg = m_msg_manager->get_message(msg->get_opcode(),
+            msg->get_payload().size());
 
         if (!outgoing_msg) {
             return error::make_error_code(error::no_outgoing_buffers);
@@ -151,6 +207,66 @@ lib::error_code connection<config>::send(typename config::message_type::ptr msg)
     return lib::error_code();
 }
 
+template <typename config>
+lib::error_code connection<config>::send_many(std::vector<message_ptr> const &
+    msgs)
+{
+    if (m_alog->static_test(log::alevel::devel)) {
+        m_alog->write(log::alevel::devel,"connection send_many");
+    }
+
+    {
+        scoped_lock_type lock(m_connection_state_lock);
+        if (m_state != session::state::open) {
+           return error::make_error_code(error::invalid_state);
+        }
+    }
+
+    lib::error_code ec;
+    bool needs_writing = false;
+
+    {
+        scoped_lock_type lock(m_write_lock);
+
+        typename std::vector<message_ptr>::const_iterator it;
+        for (it = msgs.begin(); it != msgs.end(); ++it) {
+            message_ptr outgoing_msg;
+
+            if ((*it)->get_prepared()) {
+                outgoing_msg = *it;
+            } else {
+                outgoing_msg = m_msg_manager->get_message(
+                    (*it)->get_opcode(),(*it)->get_payload().size());
+
+                if (!outgoing_msg) {
+                    ec = error::make_error_code(error::no_outgoing_buffers);
+                    break;
+                }
+
+                ec = m_processor->prepare_data_frame(*it,outgoing_msg);
+                if (ec) {
+                    break;
+                }
+            }
+
+            write_push(outgoing_msg);
+        }
+
+        needs_writing = !m_write_flag && !m_send_queue.empty();
+    }
+
+    // Start the write even if a message failed, so that the messages queued
+    // before it go out.
+    if (needs_writing) {
+        transport_con_type::dispatch(lib::bind(
+            &type::write_frame,
+            type::get_shared()
+        ));
+    }
+
+    return ec;
+}
+
 template <typename config>
 void connection<config>::ping(std::string const& payload, lib::error_code& ec) {
     if (m_alog->static_test(log::alevel::devel)) {
@@ -177,8 +293,9 @@ void connection<config>::ping(std::string const& payload, lib::error_code& ec) {
     ec = m_processor->prepare_ping(payload,msg);
     if (ec) {return;}
 
-    // set ping timer if we are listening for one
-    if (m_pong_timeout_handler) {
+    // set ping timer if we are listening for one, or if it's needed for
+    // keepalive
+    if (m_pong_timeout_handler || m_keepalive_interval > 0) {
         // Cancel any existing timers
         if (m_ping_timer) {
             m_ping_timer->cancel();
@@ -246,6 +363,57 @@ void connection<config>::handle_pong_timeout(std::string payload,
     if (m_pong_timeout_handler) {
         m_pong_timeout_handler(m_connection_hdl,payload);
     }
+
+    if (m_keepalive_interval > 0 && get_state() == session::state::open) {
+        log_err(log::elevel::info, "keepalive",
+            error::make_error_code(error::pong_timeout));
+        this->terminate(error::make_error_code(error::pong_timeout));
+    }
+}
+
+template <typename config>
+void connection<config>::start_keepalive_timer() {
+    if (m_keepalive_interval <= 0) {
+        return;
+    }
+    m_keepalive_timer = transport_con_type::set_timer(
+        m_keepalive_interval,
+        lib::bind(
+            &type::handle_keepalive_timer,
+            type::get_shared(),
+            lib::placeholders::_1
+        )
+    );
+}
+
+template <typename config>
+void connection<config>::handle_keepalive_timer(lib::error_code const & ec) {
+    if (ec) {
+        if (ec != transport::error::operation_aborted) {
+            log_err(log::elevel::devel, "keepalive timer", ec);
+        }
+        return;
+    }
+
+    if (get_state() != session::state::open) {
+        return;
+    }
+
+    if (!m_keepalive_pending) {
+        std::stringstream payload;
+        payload << lib::chrono::duration_cast<lib::chrono::microseconds>(
+            lib::chrono::steady_clock::now().time_since_epoch()).count();
+
+        lib::error_code ping_ec;
+        ping(payload.str(), ping_ec);
+        if (ping_ec) {
+            log_err(log::elevel::devel, "keepalive ping", ping_ec);
+        } else {
+            m_keepalive_pending = true;
+        }
+    }
+
+    start_keepalive_timer();
 }
 
 template <typename config>
@@ -388,8 +556,16 @@ lib::error_code connection<config>::resume_reading() {
 /// Resume reading helper method. Not safe to call directly
 template <typename config>
 void connection<config>::handle_resume_reading() {
-   m_read_flag = true;
-   read_frame();
+    if (m_read_flag || get_state() == session::state::closed) {
+        return;
+    }
+    m_read_flag = true;
+    // If the pause took effect while a read was outstanding, that read will
+    // continue reading when it completes. Starting another one here would
+    // have two reads filling m_buf at once.
+    if (!m_read_pending) {
+        read_frame();
+    }
 }
 
 
@@ -967,6 +1143,8 @@ void connection<config>::handle_read_frame(lib::error_code const & ec,
 {
     //m_alog->write(log::alevel::devel,"connection handle_read_frame");
 
+    m_read_pending = false;
+
     lib::error_code ecm = ec;
 
     if (!ecm && m_internal_state != istate::PROCESS_CONNECTION) {
@@ -1021,7 +1199,12 @@ void connection<config>::handle_read_frame(lib::error_code const & ec,
         return;
     }*/
 
+    if (m_read_data_handler && bytes_transferred > 0) {
+        m_read_data_handler(m_connection_hdl, m_buf, bytes_transferred);
+    }
+
     size_t p = 0;
+    uint64_t frames_before = m_processor->get_frames_read();
 
     if (m_alog->static_test(log::alevel::devel)) {
         std::stringstream s;
@@ -1102,6 +1285,11 @@ void connection<config>::handle_read_frame(lib::error_code const & ec,
         }
     }
 
+    if (m_read_complete_handler) {
+        m_read_complete_handler(m_connection_hdl, static_cast<size_t>(
+            m_processor->get_frames_read() - frames_before));
+    }
+
     read_frame();
 }
 
@@ -1111,7 +1299,8 @@ void connection<config>::read_frame() {
     if (!m_read_flag) {
         return;
     }
-    
+
+    m_read_pending = true;
     transport_con_type::async_read_at_least(
         // std::min wont work with undefined static const values.
         // TODO: is there a more elegant way to do this?
@@ -1427,6 +1616,8 @@ void connection<config>::handle_write_http_response(lib::error_code const & ec)
         m_open_handler(m_connection_hdl);
     }
 
+    start_keepalive_timer();
+
     this->handle_read_frame(lib::error_code(), m_buf_cursor);
 }
 
@@ -1628,6 +1819,7 @@ void connection<config>::handle_read_http_response(lib::error_code const & ec,
                 + neg_results.first.message());
             this->terminate(make_error_code(error::extension_neg_failed));
             // TODO: close connection with reason 1010 (and list extensions)
+            return;
         }
 
         // response is valid, connection can now be assumed to be open      
@@ -1640,6 +1832,8 @@ void connection<config>::handle_read_http_response(lib::error_code const & ec,
             m_open_handler(m_connection_hdl);
         }
 
+        start_keepalive_timer();
+
         // The remaining bytes in m_buf are frame data. Copy them to the
         // beginning of the buffer and note the length. They will be read after
         // the handshake completes and before more bytes are read.
@@ -1706,6 +1900,26 @@ void connection<config>::terminate(lib::error_code const & ec) {
         m_handshake_timer.reset();
     }
 
+    // Stop keepalive
+    if (m_keepalive_timer) {
+        m_keepalive_timer->cancel();
+        m_keepalive_timer.reset();
+    }
+    if (m_keepalive_interval > 0 && m_ping_timer) {
+        m_ping_timer->cancel();
+    }
+
+    // Cancel a pending write flush. Bumping the generation makes a flush
+    // callback that is already queued return without writing.
+    {
+        scoped_lock_type lock(m_write_lock);
+        if (m_write_flush_timer) {
+            m_write_flush_timer->cancel();
+            m_write_flush_timer.reset();
+        }
+        ++m_write_flush_generation;
+    }
+
     terminate_status tstat = unknown;
     if (ec) {
         m_ec = ec;
@@ -1804,15 +2018,60 @@ void connection<config>::write_frame() {
             return;
         }
 
-        // pull off all the messages that are ready to write.
-        // stop if we get a message marked terminal
-        message_ptr next_message = write_pop();
-        while (next_message) {
+        if (m_send_queue.empty()) {
+            return;
+        }
+
+        // With a coalescing window, a write on an idle connection waits a
+        // moment for more frames, unless enough are queued already.
+        if (m_write_flush_delay > 0 && !m_write_flush_now &&
+            !write_budget_reached())
+        {
+            if (!m_write_flush_timer) {
+                m_write_flush_timer = transport_con_type::set_timer_us(
+                    m_write_flush_delay,
+                    lib::bind(
+                        &type::handle_write_flush_timeout,
+                        type::get_shared(),
+                        ++m_write_flush_generation,
+                        lib::placeholders::_1
+                    )
+                );
+            }
+            // Transports without timers return an empty timer; write now.
+            if (m_write_flush_timer) {
+                return;
+            }
+        }
+        m_write_flush_now = false;
+        if (m_write_flush_timer) {
+            m_write_flush_timer->cancel();
+            m_write_flush_timer.reset();
+        }
+
+        // pull off all the messages that are ready to write, up to the
+        // coalescing limits. stop if we get a message marked terminal
+        size_t write_bytes = 0;
+        while (!m_send_queue.empty()) {
+            message_ptr const & front = m_send_queue.front();
+            size_t frame_bytes = front->get_header().size() +
+                front->get_payload().size();
+
+            if (!m_current_msgs.empty() &&
+                ((m_write_max_frames > 0 &&
+                    m_current_msgs.size() >= m_write_max_frames) ||
+                 (m_write_max_bytes > 0 &&
+                    write_bytes + frame_bytes > m_write_max_bytes)))
+            {
+                break;
+            }
+
+            message_ptr next_message = write_pop();
+            write_bytes += frame_bytes;
             m_current_msgs.push_back(next_message);
-            if (!next_message->get_terminal()) {
-                next_message = write_pop();
-            } else {
-                next_message = message_ptr();
+            m_write_in_flight += next_message->get_payload().size();
+            if (next_message->get_terminal()) {
+                break;
             }
         }
         
@@ -1893,11 +2152,25 @@ void connection<config>::handle_write_frame(lib::error_code const & ec)
     }
 
     bool terminal = m_current_msgs.back()->get_terminal();
+    size_t frames = m_current_msgs.size();
+    size_t data_frames = 0;
+    for (size_t i = 0; i < frames; i++) {
+        if (!frame::opcode::is_control(m_current_msgs[i]->get_opcode())) {
+            data_frames++;
+        }
+    }
 
     m_send_buffer.clear();
     m_current_msgs.clear();
     // TODO: recycle instead of deleting
 
+    {
+        // The write is over, whether or not it succeeded, so its payloads no
+        // longer count towards get_unsent_amount().
+        scoped_lock_type lock(m_write_lock);
+        m_write_in_flight = 0;
+    }
+
     if (ec) {
         log_err(log::elevel::fatal,"handle_write_frame",ec);
         this->terminate(ec);
@@ -1917,6 +2190,14 @@ void connection<config>::handle_write_frame(lib::error_code const & ec)
         m_write_flag = false;
 
         needs_writing = !m_send_queue.empty();
+
+        // Frames queued during the write have already had their chance to
+        // coalesce, so don't delay them further.
+        m_write_flush_now = needs_writing;
+    }
+
+    if (m_write_complete_handler) {
+        m_write_complete_handler(m_connection_hdl, frames, data_frames);
     }
 
     if (needs_writing) {
@@ -1927,6 +2208,29 @@ void connection<config>::handle_write_frame(lib::error_code const & ec)
     }
 }
 
+template <typename config>
+void connection<config>::handle_write_flush_timeout(size_t generation,
+    lib::error_code const & ec)
+{
+    if (ec) {
+        // Cancelled, or the timer failed; in either case the connection is
+        // closing or a write has already taken the coalesced frames.
+        return;
+    }
+
+    {
+        scoped_lock_type lock(m_write_lock);
+        if (!m_write_flush_timer || generation != m_write_flush_generation) {
+            // Superseded by a write that started before the timer expired.
+            return;
+        }
+        m_write_flush_timer.reset();
+        m_write_flush_now = true;
+    }
+
+    write_frame();
+}
+
 template <typename config>
 std::vector<int> const & connection<config>::get_supported_versions() const
 {
@@ -1968,6 +2272,7 @@ void connection<config>::process_control_frame(typename config::message_type::pt
             }
         }
     } else if (op == frame::opcode::PONG) {
+        m_keepalive_pending = false;
         if (m_pong_handler) {
             m_pong_handler(m_connection_hdl, msg->get_payload());
         }
@@ -2202,10 +2507,22 @@ connection<config>::get_processor(int version) const {
     
     // Settings not configured by the constructor
     p->set_max_message_size(m_max_message_size);
+    p->set_stream_chunk_size(m_stream_chunk_size);
     
     return p;
 }
 
+template <typename config>
+bool connection<config>::write_budget_reached() const
+{
+    if (m_write_max_frames > 0 && m_send_queue.size() >= m_write_max_frames) {
+        return true;
+    }
+    // m_send_buffer_size counts payload bytes only, which is close enough
+    // for deciding whether to wait for more frames.
+    return m_write_max_bytes > 0 && m_send_buffer_size >= m_write_max_bytes;
+}
+
 template <typename config>
 void connection<config>::write_push(typename config::message_type::ptr msg)
 {
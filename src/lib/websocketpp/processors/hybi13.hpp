@@ -72,6 +72,7 @@ public:
     explicit hybi13(bool secure, bool p_is_server, msg_manager_ptr manager, rng_type& rng)
       : processor<config>(secure, p_is_server)
       , m_msg_manager(manager)
+      , m_chunk_ready(false)
       , m_rng(rng)
     {
         reset_headers();
@@ -268,7 +269,11 @@ public:
 
         req.replace_header("Sec-WebSocket-Key",base64_encode(raw_key, 16));
 
-        if (m_permessage_deflate.is_implemented()) {
+        // An extension offer set by the application takes precedence over the
+        // default offer.
+        if (m_permessage_deflate.is_implemented()
+            && req.get_header("Sec-WebSocket-Extensions").empty())
+        {
             std::string offer = m_permessage_deflate.generate_offer();
             if (!offer.empty()) {
                 req.replace_header("Sec-WebSocket-Extensions",offer);
@@ -436,7 +441,9 @@ public:
                     m_current_msg = &m_control_msg;
                 } else {
                     if (!m_data_msg.msg_ptr) {
-                        if (m_bytes_needed > base::m_max_message_size) {
+                        if (!base::m_stream_chunk_size &&
+                            m_bytes_needed > base::m_max_message_size)
+                        {
                             ec = make_error_code(error::message_too_big);
                             break;
                         }
@@ -454,7 +461,9 @@ public:
                         // are writing into.
                         std::string & out = m_data_msg.msg_ptr->get_raw_payload();
                         
-                        if (out.size() + m_bytes_needed > base::m_max_message_size) {
+                        if (!base::m_stream_chunk_size &&
+                            out.size() + m_bytes_needed > base::m_max_message_size)
+                        {
                             ec = make_error_code(error::message_too_big);
                             break;
                         }
@@ -484,16 +493,32 @@ public:
                 }
 
                 if (m_bytes_needed > 0) {
+                    // When streaming, hand back what has collected so far
+                    // once there's enough of it.
+                    if (streaming_data() && m_data_msg.msg_ptr->
+                        get_raw_payload().size() >= base::m_stream_chunk_size)
+                    {
+                        m_chunk_ready = true;
+                        m_state = READY;
+                    }
                     continue;
                 }
 
+                base::m_frames_read++;
+
                 // If this was the last frame in the message set the ready flag.
-                // Otherwise, reset processor state to read additional frames.
+                // Otherwise, reset processor state to read additional frames,
+                // after handing back the frame's payload if streaming.
                 if (frame::get_fin(m_basic_header)) {
                     ec = finalize_message();
                     if (ec) {
                         break;
                     }
+                } else if (streaming_data() &&
+                    !m_data_msg.msg_ptr->get_raw_payload().empty())
+                {
+                    m_chunk_ready = true;
+                    m_state = READY;
                 } else {
                     this->reset_headers();
                 }
@@ -568,6 +593,11 @@ public:
         if (!ready()) {
             return message_ptr();
         }
+        if (m_chunk_ready) {
+            m_chunk_ready = false;
+            return next_chunk();
+        }
+
         message_ptr ret = m_current_msg->msg_ptr;
         m_current_msg->msg_ptr.reset();
 
@@ -608,26 +638,52 @@ public:
             return make_error_code(error::invalid_arguments);
         }
 
-        frame::opcode::value op = in->get_opcode();
+        std::string const & i = in->get_raw_payload();
+
+        return prepare_data_frame_buffer(in->get_opcode(), i.data(), i.size(),
+            in->get_fin(), in->get_compressed(), out);
+    }
+
+    /// Prepare a user data frame directly from a buffer
+    /**
+     * Like prepare_data_frame(), but reads the payload from a caller-owned
+     * buffer instead of from a message. The payload is masked (or compressed)
+     * straight from the buffer into the output message, so no intermediate
+     * copy of it is made. The buffer is not referenced after this returns.
+     *
+     * @param op The opcode of the frame
+     * @param payload A pointer to the payload bytes
+     * @param len The length of the payload
+     * @param fin Whether this is the final frame of the message
+     * @param compressible Whether the payload may be compressed, if
+     * compression was negotiated
+     * @param out A message to be overwritten with the prepared message
+     * @return error code
+     */
+    virtual lib::error_code prepare_data_frame_buffer(frame::opcode::value op,
+        void const * payload, size_t len, bool fin, bool compressible,
+        message_ptr out)
+    {
+        if (!out || (!payload && len > 0)) {
+            return make_error_code(error::invalid_arguments);
+        }
 
         // validate opcode: only regular data frames
         if (frame::opcode::is_control(op)) {
             return make_error_code(error::invalid_opcode);
         }
 
-        std::string& i = in->get_raw_payload();
+        char const * i = static_cast<char const *>(payload);
         std::string& o = out->get_raw_payload();
 
         // validate payload utf8
-        if (op == frame::opcode::TEXT && !utf8_validator::validate(i)) {
+        if (op == frame::opcode::TEXT && !utf8_validator::validate(i,len)) {
             return make_error_code(error::invalid_payload);
         }
 
         frame::masking_key_type key;
         bool masked = !base::m_server;
-        bool compressed = m_permessage_deflate.is_enabled()
-                          && in->get_compressed();
-        bool fin = in->get_fin();
+        bool compressed = m_permessage_deflate.is_enabled() && compressible;
 
         if (masked) {
             // Generate masking key.
@@ -639,7 +695,8 @@ public:
         // prepare payload
         if (compressed) {
             // compress and store in o after header.
-            m_permessage_deflate.compress(i,o);
+            m_permessage_deflate.compress(
+                reinterpret_cast<uint8_t const *>(i),len,o);
 
             if (o.size() < 4) {
                 return make_error_code(error::general);
@@ -651,19 +708,19 @@ public:
 
             // mask in place if necessary
             if (masked) {
-                this->masked_copy(o,o,key);
+                this->masked_copy(o.data(),o.size(),o,key);
             }
         } else {
             // no compression, just copy data into the output buffer
-            o.resize(i.size());
+            o.resize(len);
 
             // if we are masked, have the masking function write to the output
             // buffer directly to avoid another copy. If not masked, copy
             // directly without masking.
             if (masked) {
-                this->masked_copy(i,o,key);
+                this->masked_copy(i,len,o,key);
             } else {
-                std::copy(i.begin(),i.end(),o.begin());
+                std::copy(i,i+len,o.begin());
             }
         }
 
@@ -729,6 +786,63 @@ public:
         return this->prepare_control(frame::opcode::CLOSE,payload,out);
     }
 protected:
+    /// True if the frame being read is part of a data message to be streamed
+    bool streaming_data() const {
+        return base::m_stream_chunk_size > 0 && m_current_msg == &m_data_msg;
+    }
+
+    /// Return the part of the data message collected so far
+    /**
+     * Called by get_message() when a part of a streamed data message is ready.
+     * The rest of the message is collected into a new message buffer. If a
+     * text part ends partway through a UTF-8 sequence, the start of that
+     * sequence is moved to the new buffer.
+     *
+     * @return The part, or an empty pointer if there is nothing to return yet
+     */
+    message_ptr next_chunk() {
+        message_ptr chunk = m_data_msg.msg_ptr;
+        std::string & out = chunk->get_raw_payload();
+
+        size_t tail = 0;
+        if (chunk->get_opcode() == frame::opcode::TEXT) {
+            // The payload has been validated, so only the last three bytes
+            // need to be checked for an incomplete sequence.
+            for (size_t i = 1; i <= 3 && i <= out.size(); i++) {
+                unsigned char c = static_cast<unsigned char>(out[out.size()-i]);
+                if ((c & 0xC0) == 0x80) {
+                    continue;
+                }
+                size_t seq_len = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 1;
+                tail = seq_len > i ? i : 0;
+                break;
+            }
+        }
+
+        if (m_bytes_needed > 0) {
+            m_state = APPLICATION;
+        } else {
+            this->reset_headers();
+        }
+
+        if (tail == out.size()) {
+            // Only part of a character so far; keep collecting.
+            return message_ptr();
+        }
+
+        message_ptr next = m_msg_manager->get_message(chunk->get_opcode(),
+            base::m_stream_chunk_size);
+        next->set_compressed(chunk->get_compressed());
+        if (tail > 0) {
+            next->get_raw_payload().assign(out, out.size() - tail, tail);
+            out.resize(out.size() - tail);
+        }
+        m_data_msg.msg_ptr = next;
+
+        chunk->set_fin(false);
+        return chunk;
+    }
+
     /// Convert a client handshake key into a server response key in place
     lib::error_code process_handshake_key(std::string & key) const {
         key.append(constants::handshake_guid);
@@ -800,9 +914,8 @@ protected:
     {
         // unmask if masked
         if (frame::get_masked(m_basic_header)) {
-            m_current_msg->prepared_key = frame::byte_mask_circ(
-                buf, len, m_current_msg->prepared_key);
-            // TODO: SIMD masking
+            m_current_msg->prepared_key = frame::simd_mask_circ(
+                buf, buf, len, m_current_msg->prepared_key);
         }
 
         std::string & out = m_current_msg->msg_ptr->get_raw_payload();
@@ -817,6 +930,14 @@ protected:
             if (ec) {
                 return 0;
             }
+            // The size checks in consume() only see compressed bytes, so
+            // check the inflated size here.
+            if (!base::m_stream_chunk_size &&
+                out.size() > base::m_max_message_size)
+            {
+                ec = make_error_code(error::message_too_big);
+                return 0;
+            }
         } else {
             // No compression, straight copy
             out.append(reinterpret_cast<char *>(buf),len);
@@ -824,7 +945,9 @@ protected:
 
         // validate unmasked, decompressed values
         if (m_current_msg->msg_ptr->get_opcode() == frame::opcode::TEXT) {
-            if (!m_current_msg->validator.decode(out.begin()+offset,out.end())) {
+            if (!m_current_msg->validator.decode(out.data()+offset,
+                out.data()+out.size()))
+            {
                 ec = make_error_code(error::invalid_utf8);
                 return 0;
             }
@@ -961,8 +1084,24 @@ protected:
     void masked_copy (std::string const & i, std::string & o,
         frame::masking_key_type key) const
     {
-        frame::byte_mask(i.begin(),i.end(),o.begin(),key);
-        // TODO: SIMD masking
+        this->masked_copy(i.data(),i.size(),o,key);
+    }
+
+    /// Copy and mask/unmask in one operation
+    /**
+     * Reads input from a buffer and writes masked output to a string that has
+     * already been sized to hold it. The input may be the output's own data.
+     *
+     * @param [in] i The input buffer.
+     * @param [in] len The length of the input buffer.
+     * @param [out] o The output string.
+     * @param [in] key The masking key to use for masking/unmasking
+     */
+    void masked_copy (char const * i, size_t len, std::string & o,
+        frame::masking_key_type key) const
+    {
+        frame::simd_mask(reinterpret_cast<uint8_t const *>(i),
+            reinterpret_cast<uint8_t *>(&o[0]),len,key);
     }
 
     /// Generic prepare control frame with opcode and payload.
@@ -1060,6 +1199,10 @@ protected:
     // Pointer to the metadata associated with the frame being read
     msg_metadata * m_current_msg;
 
+    // True if the READY state is for a part of a streamed data message,
+    // rather than a complete message
+    bool m_chunk_ready;
+
     // Extended header of current frame
     frame::extended_header m_extended_header;
 
@@ -169,6 +169,8 @@ public:
       : m_secure(secure)
       , m_server(p_is_server)
       , m_max_message_size(config::max_message_size)
+      , m_stream_chunk_size(0)
+      , m_frames_read(0)
     {}
 
     virtual ~processor() {}
@@ -204,6 +206,46 @@ public:
         m_max_message_size = new_value;
     }
 
+    /// Get the size of the parts that incoming data messages are returned in
+    /**
+     * @see set_stream_chunk_size()
+     *
+     * @return The chunk size, or 0 if messages are returned whole
+     */
+    size_t get_stream_chunk_size() const {
+        return m_stream_chunk_size;
+    }
+
+    /// Set the size of the parts that incoming data messages are returned in
+    /**
+     * If this is nonzero, get_message() returns each data message in parts as
+     * its payload arrives, instead of returning it whole once it is complete.
+     * A part is returned once it has at least this many payload bytes, and
+     * at the end of each frame. Every part but the last has its fin flag
+     * cleared. Text parts always end on a UTF-8 code point boundary.
+     *
+     * The maximum message size does not apply to messages returned in parts,
+     * since they are never held in memory all at once.
+     *
+     * Processors that don't support this return messages whole. The default
+     * is 0.
+     *
+     * @param new_value The chunk size, or 0 to return messages whole
+     */
+    void set_stream_chunk_size(size_t new_value) {
+        m_stream_chunk_size = new_value;
+    }
+
+    /// Get the number of complete frames read so far
+    /**
+     * Processors that don't count frames return 0.
+     *
+     * @return The number of frames read
+     */
+    uint64_t get_frames_read() const {
+        return m_frames_read;
+    }
+
     /// Returns whether or not the permessage_compress extension is implemented
     /**
      * Compile time flag that indicates whether this processor has implemented
@@ -357,6 +399,19 @@ public:
      */
     virtual lib::error_code prepare_data_frame(message_ptr in, message_ptr out) = 0;
 
+    /// Prepare a data frame for writing directly from a buffer
+    /**
+     * Like prepare_data_frame(), but reads the payload from a caller-owned
+     * buffer, avoiding a copy into an intermediate message. Processors that
+     * don't support this return error::not_implemented, and the caller should
+     * fall back to prepare_data_frame().
+     */
+    virtual lib::error_code prepare_data_frame_buffer(frame::opcode::value,
+        void const *, size_t, bool, bool, message_ptr)
+    {
+        return make_error_code(error::not_implemented);
+    }
+
     /// Prepare a ping frame
     /**
      * Ping preparation is entirely state free. There is no payload validation
@@ -399,6 +454,8 @@ protected:
     bool const m_secure;
     bool const m_server;
     size_t m_max_message_size;
+    size_t m_stream_chunk_size;
+    uint64_t m_frames_read;
 };
 
 } // namespace processor
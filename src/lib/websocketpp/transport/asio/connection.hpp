@@ -311,10 +311,30 @@ public:
      * needed.
      */
     timer_ptr set_timer(long duration, timer_handler callback) {
+        return start_timer(lib::asio::milliseconds(duration), callback);
+    }
+
+    /// Call back a function after a period of time in microseconds
+    /**
+     * Like set_timer, but with microsecond resolution, for short delays.
+     *
+     * @param duration Length of time to wait in microseconds
+     *
+     * @param callback The function to call back when the timer has expired
+     *
+     * @return A handle that can be used to cancel the timer if it is no longer
+     * needed.
+     */
+    timer_ptr set_timer_us(long duration, timer_handler callback) {
+        return start_timer(lib::asio::microseconds(duration), callback);
+    }
+
+    template <typename duration_type>
+    timer_ptr start_timer(duration_type duration, timer_handler callback) {
         timer_ptr new_timer(
             new lib::asio::steady_timer(
                 *m_io_service,
-                lib::asio::milliseconds(duration))
+                duration)
         );
 
         if (config::enable_multithreading) {
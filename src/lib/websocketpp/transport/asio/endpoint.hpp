@@ -40,6 +40,8 @@
 
 #include <sstream>
 #include <string>
+#include <utility>
+#include <vector>
 
 namespace ws_websocketpp {
 namespace transport {
@@ -108,6 +110,29 @@ namespace _workaround_gcc_libstdcpp_issue_68307_missing_values {
 #endif
 } // namespace _workaround
 
+/// Interface for sharing DNS results between connections
+/**
+ * An endpoint with a resolve_cache (see endpoint::set_resolve_cache) looks up
+ * each host and port in it before resolving them, stores the results of
+ * successful resolves in it, and erases the entry when none of its addresses
+ * can be connected to.
+ */
+class resolve_cache {
+public:
+    typedef std::vector<lib::asio::ip::tcp::endpoint> endpoint_list;
+
+    virtual ~resolve_cache() {}
+
+    /// Set `out` to the addresses for a host and port, if there are any
+    virtual bool lookup(std::string const & host, std::string const & port,
+        endpoint_list & out) = 0;
+    /// Save the addresses for a host and port
+    virtual void store(std::string const & host, std::string const & port,
+        endpoint_list const & endpoints) = 0;
+    /// Forget the addresses for a host and port
+    virtual void erase(std::string const & host, std::string const & port) = 0;
+};
+
 /// Asio based endpoint transport component
 /**
  * transport::asio::endpoint implements an endpoint transport component using
@@ -158,6 +183,7 @@ public:
     explicit endpoint()
       : m_io_service(NULL)
       , m_external_io_service(false)
+      , m_resolve_cache(NULL)
       , m_listen_backlog(lib::asio::socket_base::max_connections)
       , m_reuse_addr(false)
       , m_state(UNINITIALIZED)
@@ -198,6 +224,7 @@ public:
       , m_io_service(src.m_io_service)
       , m_external_io_service(src.m_external_io_service)
       , m_acceptor(src.m_acceptor)
+      , m_resolve_cache(src.m_resolve_cache)
       , m_listen_backlog(lib::asio::socket_base::max_connections)
       , m_reuse_addr(src.m_reuse_addr)
       , m_elog(src.m_elog)
@@ -381,6 +408,17 @@ public:
         m_tcp_post_init_handler = h;
     }
 
+    /// Sets the cache of DNS results used by outgoing connections
+    /**
+     * The cache is not owned by the endpoint and must outlive it. NULL, the
+     * default, resolves every connection's host.
+     *
+     * @param cache The cache to use, or NULL
+     */
+    void set_resolve_cache(resolve_cache * cache) {
+        m_resolve_cache = cache;
+    }
+
     /// Sets the maximum length of the queue of pending connections.
     /**
      * Sets the maximum length of the queue of pending connections. Increasing
@@ -947,6 +985,16 @@ protected:
             port = pu->get_port_str();
         }
 
+        resolve_cache::endpoint_list endpoints;
+        if (m_resolve_cache && m_resolve_cache->lookup(host, port, endpoints)) {
+            if (m_alog->static_test(log::alevel::devel)) {
+                m_alog->write(log::alevel::devel,
+                    "using cached DNS results for "+host+":"+port);
+            }
+            start_connect(tcon, cb, host, port, endpoints);
+            return;
+        }
+
         tcp::resolver::query query(host,port);
 
         if (m_alog->static_test(log::alevel::devel)) {
@@ -976,6 +1024,8 @@ protected:
                     tcon,
                     dns_timer,
                     cb,
+                    host,
+                    port,
                     lib::placeholders::_1,
                     lib::placeholders::_2
                 ))
@@ -989,6 +1039,8 @@ protected:
                     tcon,
                     dns_timer,
                     cb,
+                    host,
+                    port,
                     lib::placeholders::_1,
                     lib::placeholders::_2
                 )
@@ -1029,7 +1081,8 @@ protected:
     }
 
     void handle_resolve(transport_con_ptr tcon, timer_ptr dns_timer,
-        connect_handler callback, lib::asio::error_code const & ec,
+        connect_handler callback, std::string const & host,
+        std::string const & port, lib::asio::error_code const & ec,
         lib::asio::ip::tcp::resolver::iterator iterator)
     {
         if (ec == lib::asio::error::operation_aborted ||
@@ -1047,61 +1100,264 @@ protected:
             return;
         }
 
+        resolve_cache::endpoint_list endpoints;
+        lib::asio::ip::tcp::resolver::iterator it, end;
+        for (it = iterator; it != end; ++it) {
+            endpoints.push_back((*it).endpoint());
+        }
+
         if (m_alog->static_test(log::alevel::devel)) {
             std::stringstream s;
             s << "Async DNS resolve successful. Results: ";
-
-            lib::asio::ip::tcp::resolver::iterator it, end;
-            for (it = iterator; it != end; ++it) {
-                s << (*it).endpoint() << " ";
+            for (size_t i = 0; i < endpoints.size(); ++i) {
+                s << endpoints[i] << " ";
             }
-
             m_alog->write(log::alevel::devel,s.str());
         }
 
-        m_alog->write(log::alevel::devel,"Starting async connect");
+        if (m_resolve_cache) {
+            m_resolve_cache->store(host, port, endpoints);
+        }
+        start_connect(tcon, callback, host, port, endpoints);
+    }
 
+    /// Delay before starting a connection attempt to the next address
+    /**
+     * Follows the recommendation of RFC 8305 (Happy Eyeballs v2).
+     */
+    static const long connect_attempt_delay = 250;
+
+    /// State shared by the connection attempts for one connection
+    /**
+     * Only accessed from handlers running in the connection's strand.
+     */
+    struct connect_race {
+        typedef lib::shared_ptr<lib::asio::ip::tcp::socket> socket_ptr;
+
+        transport_con_ptr tcon;
+        connect_handler callback;
+        std::string host;
+        std::string port;
+        resolve_cache::endpoint_list endpoints;
+        std::vector<socket_ptr> sockets;
         timer_ptr con_timer;
+        timer_ptr attempt_timer;
+        size_t next;
+        size_t pending;
+        bool done;
+        lib::asio::error_code last_ec;
+    };
+    typedef lib::shared_ptr<connect_race> connect_race_ptr;
 
-        con_timer = tcon->set_timer(
+    /// Connect to the first of a list of addresses that accepts
+    /**
+     * Connection attempts are started in turn, each connect_attempt_delay
+     * after the previous one or as soon as the previous one fails, and
+     * alternate between address families, starting with the family of the
+     * first address. The first socket to connect is used for the connection
+     * and the other attempts are abandoned. config::timeout_connect applies
+     * to the whole process.
+     */
+    void start_connect(transport_con_ptr tcon, connect_handler callback,
+        std::string const & host, std::string const & port,
+        resolve_cache::endpoint_list const & endpoints)
+    {
+        connect_race_ptr race = lib::make_shared<connect_race>();
+        race->tcon = tcon;
+        race->callback = callback;
+        race->host = host;
+        race->port = port;
+        race->next = 0;
+        race->pending = 0;
+        race->done = false;
+
+        // Interleave the address families
+        resolve_cache::endpoint_list first, second;
+        for (size_t i = 0; i < endpoints.size(); ++i) {
+            if (endpoints[i].protocol() == endpoints[0].protocol()) {
+                first.push_back(endpoints[i]);
+            } else {
+                second.push_back(endpoints[i]);
+            }
+        }
+        for (size_t i = 0; i < first.size() || i < second.size(); ++i) {
+            if (i < first.size()) race->endpoints.push_back(first[i]);
+            if (i < second.size()) race->endpoints.push_back(second[i]);
+        }
+
+        m_alog->write(log::alevel::devel,"Starting async connect");
+
+        race->con_timer = tcon->set_timer(
             config::timeout_connect,
             lib::bind(
-                &type::handle_connect_timeout,
+                &type::handle_connect_race_timeout,
                 this,
-                tcon,
-                con_timer,
-                callback,
+                race,
                 lib::placeholders::_1
             )
         );
 
+        if (race->endpoints.empty()) {
+            race->last_ec = lib::asio::error::host_not_found;
+            finish_connect(race);
+            return;
+        }
+
+        start_connect_attempt(race);
+    }
+
+    /// Start a connection attempt to the next address
+    void start_connect_attempt(connect_race_ptr race) {
+        if (race->attempt_timer) {
+            race->attempt_timer->cancel();
+            race->attempt_timer.reset();
+        }
+
+        size_t i = race->next++;
+        lib::asio::ip::tcp::endpoint const & ep = race->endpoints[i];
+
+        if (m_alog->static_test(log::alevel::devel)) {
+            std::stringstream s;
+            s << "Attempting TCP connect to " << ep;
+            m_alog->write(log::alevel::devel,s.str());
+        }
+
+        typename connect_race::socket_ptr socket =
+            lib::make_shared<lib::asio::ip::tcp::socket>(*m_io_service);
+        race->sockets.push_back(socket);
+        race->pending++;
+
         if (config::enable_multithreading) {
-            lib::asio::async_connect(
-                tcon->get_raw_socket(),
-                iterator,
-                tcon->get_strand()->wrap(lib::bind(
-                    &type::handle_connect,
+            socket->async_connect(
+                ep,
+                race->tcon->get_strand()->wrap(lib::bind(
+                    &type::handle_connect_attempt,
                     this,
-                    tcon,
-                    con_timer,
-                    callback,
+                    race,
+                    socket,
                     lib::placeholders::_1
                 ))
             );
         } else {
-            lib::asio::async_connect(
-                tcon->get_raw_socket(),
-                iterator,
+            socket->async_connect(
+                ep,
                 lib::bind(
-                    &type::handle_connect,
+                    &type::handle_connect_attempt,
                     this,
-                    tcon,
-                    con_timer,
-                    callback,
+                    race,
+                    socket,
                     lib::placeholders::_1
                 )
             );
         }
+
+        if (race->next < race->endpoints.size()) {
+            race->attempt_timer = race->tcon->set_timer(
+                connect_attempt_delay,
+                lib::bind(
+                    &type::handle_connect_attempt_delay,
+                    this,
+                    race,
+                    lib::placeholders::_1
+                )
+            );
+        }
+    }
+
+    void handle_connect_attempt_delay(connect_race_ptr race,
+        lib::error_code const & ec)
+    {
+        if (ec || race->done || race->next >= race->endpoints.size()) {
+            return;
+        }
+        start_connect_attempt(race);
+    }
+
+    void handle_connect_attempt(connect_race_ptr race,
+        typename connect_race::socket_ptr socket,
+        lib::asio::error_code const & ec)
+    {
+        race->pending--;
+
+        if (race->done) {
+            return;
+        }
+
+        if (ec) {
+            if (m_alog->static_test(log::alevel::devel)) {
+                m_alog->write(log::alevel::devel,
+                    "TCP connect attempt failed: "+ec.message());
+            }
+            race->last_ec = ec;
+            lib::asio::error_code cec;
+            socket->close(cec);
+            if (race->next < race->endpoints.size()) {
+                start_connect_attempt(race);
+            } else if (race->pending == 0) {
+                // Every address failed, so the cached results may be stale
+                if (m_resolve_cache) {
+                    m_resolve_cache->erase(race->host, race->port);
+                }
+                finish_connect(race);
+            }
+            return;
+        }
+
+        close_connect_attempts(race, socket);
+        race->tcon->get_raw_socket() = std::move(*socket);
+        race->last_ec = lib::asio::error_code();
+        finish_connect(race);
+    }
+
+    /// Connect timeout handler for start_connect
+    void handle_connect_race_timeout(connect_race_ptr race,
+        lib::error_code const & ec)
+    {
+        if (ec == transport::error::operation_aborted || race->done) {
+            m_alog->write(log::alevel::devel,
+                "asio handle_connect_timeout timer cancelled");
+            return;
+        }
+
+        lib::error_code ret_ec;
+        if (ec) {
+            log_err(log::elevel::devel,"asio handle_connect_timeout",ec);
+            ret_ec = ec;
+        } else {
+            ret_ec = make_error_code(transport::error::timeout);
+        }
+
+        m_alog->write(log::alevel::devel,"TCP connect timed out");
+        race->done = true;
+        if (m_resolve_cache) {
+            m_resolve_cache->erase(race->host, race->port);
+        }
+        close_connect_attempts(race, typename connect_race::socket_ptr());
+        race->callback(ret_ec);
+    }
+
+    /// Stop the timers and close every socket of a race except `keep`
+    void close_connect_attempts(connect_race_ptr race,
+        typename connect_race::socket_ptr keep)
+    {
+        if (race->attempt_timer) {
+            race->attempt_timer->cancel();
+            race->attempt_timer.reset();
+        }
+        for (size_t i = 0; i < race->sockets.size(); ++i) {
+            if (race->sockets[i] != keep) {
+                lib::asio::error_code cec;
+                race->sockets[i]->close(cec);
+            }
+        }
+        race->sockets.clear();
+    }
+
+    /// Report the result of a race, in the same way as handle_connect
+    void finish_connect(connect_race_ptr race) {
+        race->done = true;
+        handle_connect(race->tcon, race->con_timer, race->callback,
+            race->last_ec);
     }
 
     /// Asio connect timeout handler
@@ -1227,6 +1483,7 @@ private:
     acceptor_ptr        m_acceptor;
     resolver_ptr        m_resolver;
     work_ptr            m_work;
+    resolve_cache *     m_resolve_cache;
 
     // Network constants
     int                 m_listen_backlog;
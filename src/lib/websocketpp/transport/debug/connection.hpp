@@ -170,6 +170,20 @@ public:
         m_timer_handler = handler;
         return timer_ptr();
     }
+
+    /// Call back a function after a period of time in microseconds
+    /**
+     * Timers are not implemented in this transport. The timer pointer will
+     * always be empty. The handler will never be called.
+     *
+     * @param duration Length of time to wait in microseconds
+     * @param callback The function to call back when the timer has expired
+     * @return A handle that can be used to cancel the timer if it is no longer
+     * needed.
+     */
+    timer_ptr set_timer_us(long, timer_handler) {
+        return timer_ptr();
+    }
     
     /// Manual input supply (read all)
     /**
@@ -328,6 +328,20 @@ public:
         return timer_ptr();
     }
 
+    /// Call back a function after a period of time in microseconds
+    /**
+     * Timers are not implemented in this transport. The timer pointer will
+     * always be empty. The handler will never be called.
+     *
+     * @param duration Length of time to wait in microseconds
+     * @param callback The function to call back when the timer has expired
+     * @return A handle that can be used to cancel the timer if it is no longer
+     * needed.
+     */
+    timer_ptr set_timer_us(long, timer_handler) {
+        return timer_ptr();
+    }
+
     /// Sets the write handler
     /**
      * The write handler is called when the iostream transport receives data
@@ -439,9 +453,11 @@ protected:
     void async_read_at_least(size_t num_bytes, char *buf, size_t len,
         read_handler handler)
     {
-        std::stringstream s;
-        s << "iostream_con async_read_at_least: " << num_bytes;
-        m_alog->write(log::alevel::devel,s.str());
+        if (m_alog->dynamic_test(log::alevel::devel)) {
+            std::stringstream s;
+            s << "iostream_con async_read_at_least: " << num_bytes;
+            m_alog->write(log::alevel::devel,s.str());
+        }
 
         if (num_bytes > len) {
             handler(make_error_code(error::invalid_num_bytes),size_t(0));
@@ -461,7 +477,8 @@ protected:
         m_buf = buf;
         m_len = len;
         m_bytes_needed = num_bytes;
-        m_read_handler = handler;
+        // swap rather than copy, which would allocate for every read
+        m_read_handler.swap(handler);
         m_cursor = 0;
         m_reading = true;
     }
@@ -671,8 +688,8 @@ private:
     void complete_read(lib::error_code const & ec) {
         m_reading = false;
 
-        read_handler handler = m_read_handler;
-        m_read_handler = read_handler();
+        read_handler handler;
+        handler.swap(m_read_handler);
 
         handler(ec,m_cursor);
     }
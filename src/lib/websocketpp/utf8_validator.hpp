@@ -31,8 +31,17 @@
 
 #include <websocketpp/common/stdint.hpp>
 
+#include <cstring>
 #include <string>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define WEBSOCKETPP_UTF8_SSE2
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define WEBSOCKETPP_UTF8_NEON
+#endif
+
 namespace ws_websocketpp {
 namespace utf8_validator {
 
@@ -77,6 +86,66 @@ inline uint32_t decode(uint32_t * state, uint32_t * codep, uint8_t byte) {
   return *state;
 }
 
+/// Skip over a run of ASCII bytes
+/**
+ * Checks the input a block at a time for bytes with the high bit set, using
+ * SSE2 on x86, NEON on 64-bit ARM, and 64-bit words elsewhere. ASCII bytes
+ * are valid UTF8 on their own, so a block with no high bits set can be
+ * skipped without running the state machine, as long as the decoder is at a
+ * code point boundary.
+ *
+ * @param [in] p The start of the input
+ * @param [in] end The end of the input
+ * @return A pointer to the first block that contains a non-ASCII byte, or to
+ * the tail that is shorter than a block. All bytes before it are ASCII.
+ */
+inline uint8_t const * skip_ascii(uint8_t const * p, uint8_t const * end) {
+#if defined(WEBSOCKETPP_UTF8_SSE2)
+    while (end - p >= 64) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<__m128i const *>(p));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<__m128i const *>(p+16));
+        __m128i c = _mm_loadu_si128(reinterpret_cast<__m128i const *>(p+32));
+        __m128i d = _mm_loadu_si128(reinterpret_cast<__m128i const *>(p+48));
+        __m128i any = _mm_or_si128(_mm_or_si128(a,b),_mm_or_si128(c,d));
+        if (_mm_movemask_epi8(any) != 0) {
+            break;
+        }
+        p += 64;
+    }
+    while (end - p >= 16) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<__m128i const *>(p));
+        if (_mm_movemask_epi8(a) != 0) {
+            break;
+        }
+        p += 16;
+    }
+#elif defined(WEBSOCKETPP_UTF8_NEON)
+    while (end - p >= 64) {
+        uint8x16_t any = vorrq_u8(vorrq_u8(vld1q_u8(p),vld1q_u8(p+16)),
+            vorrq_u8(vld1q_u8(p+32),vld1q_u8(p+48)));
+        if (vmaxvq_u8(any) >= 0x80) {
+            break;
+        }
+        p += 64;
+    }
+    while (end - p >= 16) {
+        if (vmaxvq_u8(vld1q_u8(p)) >= 0x80) {
+            break;
+        }
+        p += 16;
+    }
+#endif
+    while (end - p >= 8) {
+        uint64_t w;
+        std::memcpy(&w,p,sizeof(w));
+        if (w & 0x8080808080808080ULL) {
+            break;
+        }
+        p += 8;
+    }
+    return p;
+}
+
 /// Provides streaming UTF8 validation functionality
 class validator {
 public:
@@ -117,6 +186,58 @@ public:
         return true;
     }
 
+    /// Advance validator state with input from a contiguous buffer
+    /**
+     * Runs of ASCII are skipped a block at a time with skip_ascii() whenever
+     * the decoder is at a code point boundary; other bytes go through the
+     * state machine one at a time. The state is carried across calls, so a
+     * message can be validated a fragment at a time.
+     *
+     * @param begin Pointer to the start of the input
+     * @param end Pointer to the end of the input
+     * @return Whether or not decoding the bytes resulted in a validation error.
+     */
+    bool decode (uint8_t const * begin, uint8_t const * end) {
+        // Only the state matters for validation, so the code point isn't
+        // computed here.
+        uint32_t state = m_state;
+        uint8_t const * p = begin;
+        while (p != end) {
+            if (state == utf8_accept) {
+                uint8_t const * next = skip_ascii(p,end);
+                if (next != p) {
+                    p = next;
+                    continue;
+                }
+            }
+
+            // Run the state machine over the next 64 bytes, which contain a
+            // non-ASCII byte (or are the short tail of the input). Text with
+            // many non-ASCII characters spends little time in skip_ascii().
+            uint8_t const * stop = (end - p > 64) ? p + 64 : end;
+            for (; p != stop; ++p) {
+                state = utf8d[256 + state*16 + utf8d[*p]];
+                if (state == utf8_reject) {
+                    m_state = state;
+                    return false;
+                }
+            }
+        }
+        m_state = state;
+        return true;
+    }
+
+    /// Advance validator state with input from a contiguous buffer
+    /**
+     * @param begin Pointer to the start of the input
+     * @param end Pointer to the end of the input
+     * @return Whether or not decoding the bytes resulted in a validation error.
+     */
+    bool decode (char const * begin, char const * end) {
+        return decode(reinterpret_cast<uint8_t const *>(begin),
+            reinterpret_cast<uint8_t const *>(end));
+    }
+
     /// Return whether the input sequence ended on a valid utf8 codepoint
     /**
      * @return Whether or not the input sequence ended on a valid codepoint.
@@ -135,19 +256,28 @@ private:
     uint32_t    m_codepoint;
 };
 
-/// Validate a UTF8 string
+/// Validate a UTF8 buffer
 /**
- * convenience function that creates a validator, validates a complete string
+ * convenience function that creates a validator, validates a complete buffer
  * and returns the result.
  */
-inline bool validate(std::string const & s) {
+inline bool validate(char const * s, size_t len) {
     validator v;
-    if (!v.decode(s.begin(),s.end())) {
+    if (!v.decode(s,s+len)) {
         return false;
     }
     return v.complete();
 }
 
+/// Validate a UTF8 string
+/**
+ * convenience function that creates a validator, validates a complete string
+ * and returns the result.
+ */
+inline bool validate(std::string const & s) {
+    return validate(s.data(),s.size());
+}
+
 } // namespace utf8_validator
 } // namespace ws_websocketpp
 
@@ -0,0 +1,404 @@
+#ifndef MESSAGE_POOL_HPP
+#define MESSAGE_POOL_HPP
+
+#include <websocketpp/common/memory.hpp>
+#include <websocketpp/common/thread.hpp>
+#include <websocketpp/frame.hpp>
+#include <websocketpp/message_buffer/message.hpp>
+
+#include <string>
+#include <vector>
+
+// Message managers for websocketpp that recycle messages instead of freeing
+// them. The client configs (see pooled_config in client.hpp) plug them in as
+// their con_msg_manager_type and endpoint_msg_manager_type.
+//
+// When the last reference to a message is released, the message is cleared
+// (keeping the capacity of its payload) and put back on a free list, from
+// which later get_message() calls are served. The shared_ptr control blocks
+// for the messages are recycled the same way, so once the pool is warm,
+// getting and releasing a message doesn't touch the heap at all.
+//
+// Messages are sorted into size classes by payload capacity. Each class has a
+// free list that is shared by every connection and every thread, guarded by a
+// mutex. In front of it, each thread keeps a small cache per class, and moves
+// messages between its cache and the shared list in batches. This matters
+// because messages are often acquired on one thread (the I/O thread that reads
+// them) and released on another (the main R thread, which handles them).
+//
+// The number of messages kept in each class is bounded, and messages whose
+// payloads have grown beyond the largest class are freed rather than kept.
+namespace message_pool {
+
+// Number of payload size classes.
+static const size_t numClasses = 8;
+
+// Payload capacity of the given size class: 128 B, 512 B, ... 2 MB.
+inline size_t classCapacity(size_t c) {
+  return size_t(128) << (2 * c);
+}
+
+// Messages with payloads larger than this are freed rather than recycled.
+inline size_t maxPooledCapacity() {
+  return classCapacity(numClasses - 1) * 2;
+}
+
+// Index of the smallest class that can hold `size` bytes, or numClasses if
+// none can.
+inline size_t classForSize(size_t size) {
+  for (size_t c = 0; c < numClasses; c++) {
+    if (size <= classCapacity(c)) {
+      return c;
+    }
+  }
+  return numClasses;
+}
+
+// Index of the largest class whose capacity is at most `cap`; that is, the
+// class that a message with payload capacity `cap` can serve requests for.
+inline size_t classForCapacity(size_t cap) {
+  size_t c = 0;
+  while (c + 1 < numClasses && classCapacity(c + 1) <= cap) {
+    c++;
+  }
+  return c;
+}
+
+// Free lists of recycled objects, one per class, shared by all threads and
+// fronted by a per-thread cache. There is one instance per object type,
+// obtained with get(). It is never destroyed, since objects may be released
+// during static destruction. Destroy is a functor type that frees an object
+// that isn't kept.
+template <typename T, size_t classes, typename Destroy>
+class FreeLists {
+public:
+  static FreeLists& get() {
+    static FreeLists* lists = new FreeLists();
+    return *lists;
+  }
+
+  // Set the most objects kept for class c in the shared list, and in each
+  // thread's cache. Must be called before the lists are used.
+  void setLimits(size_t c, size_t maxShared, size_t maxLocal) {
+    this->maxShared[c] = maxShared;
+    this->maxLocal[c] = maxLocal < 2 ? 2 : maxLocal;
+    shared[c].reserve(maxShared);
+  }
+
+  // Take an object from class c, or return NULL if there are none.
+  T* pop(size_t c) {
+    ThreadCache* tc = cache();
+    if (!tc) {
+      ws_websocketpp::lib::lock_guard<ws_websocketpp::lib::mutex> lock(listsMutex);
+      if (shared[c].empty()) {
+        return NULL;
+      }
+      T* t = shared[c].back();
+      shared[c].pop_back();
+      return t;
+    }
+
+    std::vector<T*>& local = tc->items[c];
+    if (local.empty()) {
+      // Take up to half a cache's worth at once.
+      ws_websocketpp::lib::lock_guard<ws_websocketpp::lib::mutex> lock(listsMutex);
+      size_t n = maxLocal[c] / 2;
+      while (n-- > 0 && !shared[c].empty()) {
+        local.push_back(shared[c].back());
+        shared[c].pop_back();
+      }
+    }
+    if (local.empty()) {
+      return NULL;
+    }
+    T* t = local.back();
+    local.pop_back();
+    return t;
+  }
+
+  // Return an object to class c. It's destroyed if the class is full.
+  void push(size_t c, T* t) {
+    ThreadCache* tc = cache();
+    if (!tc) {
+      std::vector<T*> one(1, t);
+      spill(c, one, 1);
+      return;
+    }
+
+    std::vector<T*>& local = tc->items[c];
+    local.push_back(t);
+    if (local.size() >= maxLocal[c]) {
+      // Give back half of the cache at once.
+      spill(c, local, maxLocal[c] / 2);
+    }
+  }
+
+private:
+  struct ThreadCache {
+    ThreadCache(FreeLists& owner, bool& destroyed)
+      : owner(owner), destroyed(destroyed)
+    {
+      for (size_t c = 0; c < classes; c++) {
+        items[c].reserve(owner.maxLocal[c]);
+      }
+    }
+
+    // Objects cached by a thread that exits go back to the shared lists.
+    ~ThreadCache() {
+      for (size_t c = 0; c < classes; c++) {
+        owner.spill(c, items[c], items[c].size());
+      }
+      destroyed = true;
+    }
+
+    FreeLists& owner;
+    bool& destroyed;
+    std::vector<T*> items[classes];
+  };
+
+  FreeLists() {
+    for (size_t c = 0; c < classes; c++) {
+      maxShared[c] = 0;
+      maxLocal[c] = 2;
+    }
+  }
+
+  // The calling thread's cache, or NULL if the thread is exiting and its
+  // cache has already been destroyed.
+  ThreadCache* cache() {
+    // This flag is trivially destructible, so it can still be read after the
+    // cache itself is gone.
+    static thread_local bool destroyed = false;
+    if (destroyed) {
+      return NULL;
+    }
+    static thread_local ThreadCache tc(*this, destroyed);
+    return &tc;
+  }
+
+  // Move the last n objects of `local` to the shared list for class c.
+  void spill(size_t c, std::vector<T*>& local, size_t n) {
+    std::vector<T*> overflow;
+    {
+      ws_websocketpp::lib::lock_guard<ws_websocketpp::lib::mutex> lock(listsMutex);
+      while (n-- > 0 && !local.empty()) {
+        if (shared[c].size() < maxShared[c]) {
+          shared[c].push_back(local.back());
+        } else {
+          overflow.push_back(local.back());
+        }
+        local.pop_back();
+      }
+    }
+    Destroy destroy;
+    for (size_t i = 0; i < overflow.size(); i++) {
+      destroy(overflow[i]);
+    }
+  }
+
+  ws_websocketpp::lib::mutex listsMutex;
+  std::vector<T*> shared[classes];
+  size_t maxShared[classes];
+  size_t maxLocal[classes];
+};
+
+// Storage for a recycled shared_ptr control block of a given size.
+template <size_t size>
+struct Block {
+  struct Destroy {
+    void operator()(Block* b) const {
+      ::operator delete(b);
+    }
+  };
+
+  typedef FreeLists<Block, 1, Destroy> Lists;
+
+  static Lists& lists() {
+    static Lists& l = init();
+    return l;
+  }
+
+  static Lists& init() {
+    Lists& l = Lists::get();
+    l.setLimits(0, 4096, 64);
+    return l;
+  }
+};
+
+// An allocator for shared_ptr control blocks that recycles them. Only single
+// object allocations, which is all shared_ptr makes, are recycled. Blocks of
+// each size have their own free list.
+template <typename T>
+class BlockAllocator {
+public:
+  typedef T value_type;
+
+  BlockAllocator() {}
+
+  template <typename U>
+  BlockAllocator(const BlockAllocator<U>&) {}
+
+  T* allocate(size_t n) {
+    if (n == 1) {
+      void* p = Block<sizeof(T)>::lists().pop(0);
+      if (p) {
+        return static_cast<T*>(p);
+      }
+    }
+    return static_cast<T*>(::operator new(n * sizeof(T)));
+  }
+
+  void deallocate(T* p, size_t n) {
+    if (n == 1) {
+      typedef Block<sizeof(T)> BlockType;
+      BlockType::lists().push(0, reinterpret_cast<BlockType*>(p));
+    } else {
+      ::operator delete(p);
+    }
+  }
+
+  template <typename U>
+  bool operator==(const BlockAllocator<U>&) const {
+    return true;
+  }
+
+  template <typename U>
+  bool operator!=(const BlockAllocator<U>&) const {
+    return false;
+  }
+};
+
+// The pool of recycled messages of a given message type.
+template <typename Message>
+class MessagePool {
+public:
+  typedef typename Message::ptr message_ptr;
+  typedef typename Message::con_msg_man_ptr con_msg_man_ptr;
+
+  static MessagePool& get() {
+    static MessagePool* pool = new MessagePool();
+    return *pool;
+  }
+
+  // Get a message with room for at least `size` bytes of payload.
+  message_ptr acquire(size_t size) {
+    size_t c = classForSize(size);
+    Message* msg = NULL;
+
+    if (c < numClasses) {
+      msg = lists.pop(c);
+      if (!msg) {
+        // Reserve the whole class, so that the message can be reused for any
+        // request in it.
+        msg = new Message(con_msg_man_ptr());
+        msg->get_raw_payload().reserve(classCapacity(c));
+      }
+    } else {
+      msg = new Message(con_msg_man_ptr());
+      msg->get_raw_payload().reserve(size);
+    }
+
+    return message_ptr(msg, Recycler(), BlockAllocator<Message>());
+  }
+
+private:
+  struct Destroy {
+    void operator()(Message* msg) const {
+      delete msg;
+    }
+  };
+
+  // The shared_ptr deleter, which returns messages to the pool.
+  struct Recycler {
+    void operator()(Message* msg) const {
+      MessagePool::get().release(msg);
+    }
+  };
+
+  typedef FreeLists<Message, numClasses, Destroy> Lists;
+
+  MessagePool() : lists(Lists::get()) {
+    for (size_t c = 0; c < numClasses; c++) {
+      // Keep up to 4 MB of payload per class in the shared lists (but no more
+      // than 1024 messages), and up to 1 MB per class per thread.
+      size_t cap = classCapacity(c);
+      size_t maxShared = (size_t(4) << 20) / cap;
+      size_t maxLocal = (size_t(1) << 20) / cap;
+      lists.setLimits(c,
+        maxShared > 1024 ? 1024 : (maxShared < 2 ? 2 : maxShared),
+        maxLocal > 32 ? 32 : maxLocal);
+    }
+  }
+
+  void release(Message* msg) {
+    std::string& payload = msg->get_raw_payload();
+    if (payload.capacity() > maxPooledCapacity()) {
+      delete msg;
+      return;
+    }
+
+    payload.clear();
+    msg->set_header(std::string());
+    msg->set_prepared(false);
+    msg->set_fin(true);
+    msg->set_terminal(false);
+    msg->set_compressed(false);
+
+    lists.push(classForCapacity(payload.capacity()), msg);
+  }
+
+  Lists& lists;
+};
+
+// A connection message manager (in websocketpp's terms) that gets messages
+// from the pool shared by all connections.
+template <typename Message>
+class ConMsgManager {
+public:
+  typedef ConMsgManager<Message> type;
+  typedef ws_websocketpp::lib::shared_ptr<ConMsgManager> ptr;
+  typedef ws_websocketpp::lib::weak_ptr<ConMsgManager> weak_ptr;
+
+  typedef typename Message::ptr message_ptr;
+
+  // An empty message.
+  message_ptr get_message() {
+    return MessagePool<Message>::get().acquire(0);
+  }
+
+  // An empty message with opcode `op` and room for at least `size` bytes of
+  // payload.
+  message_ptr get_message(ws_websocketpp::frame::opcode::value op, size_t size) {
+    message_ptr msg = MessagePool<Message>::get().acquire(size);
+    msg->set_opcode(op);
+    return msg;
+  }
+
+  // Pooled messages are returned to the pool by their shared_ptr deleter, so
+  // this is never called.
+  bool recycle(Message*) {
+    return false;
+  }
+};
+
+// An endpoint message manager that shares one ConMsgManager among all
+// connections. Since the pool itself is shared, the manager holds no state of
+// its own.
+template <typename ConManager>
+class EndpointMsgManager {
+public:
+  typedef typename ConManager::ptr con_msg_man_ptr;
+
+  EndpointMsgManager() : manager(ws_websocketpp::lib::make_shared<ConManager>()) {}
+
+  con_msg_man_ptr get_manager() const {
+    return manager;
+  }
+
+private:
+  con_msg_man_ptr manager;
+};
+
+} // namespace message_pool
+
+#endif
@@ -0,0 +1,334 @@
+#ifndef REPLAY_CLIENT_HPP
+#define REPLAY_CLIENT_HPP
+
+#include "client.hpp"
+#include "capture.h"
+#include <websocketpp/config/core_client.hpp>
+#include <websocketpp/base64/base64.hpp>
+#include <websocketpp/sha1/sha1.hpp>
+#include <chrono>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+
+// Client configs for replaying a capture file. These use the iostream
+// transport, which has no socket: bytes are passed in with read_some(), and
+// written bytes are passed to a write handler.
+struct replay_client_config : public pooled_config<ws_websocketpp::config::core_client> {};
+struct replay_client_deflate : public replay_client_config {
+  typedef ws_websocketpp::extensions::permessage_deflate::enabled
+    <permessage_deflate_config> permessage_deflate_type;
+};
+typedef ws_websocketpp::client<replay_client_config> ws_replay_client;
+typedef ws_websocketpp::client<replay_client_deflate> ws_replay_deflate_client;
+
+// Whether a captured handshake response accepted permessage-deflate, in which
+// case the replay needs a client with the extension enabled.
+inline bool replayUsesDeflate(const std::string& response) {
+  ws_websocketpp::http::parser::response parsed;
+  try {
+    parsed.consume(response.data(), response.size());
+  } catch (const ws_websocketpp::http::exception&) {
+    return false;
+  }
+  return parsed.get_header("Sec-WebSocket-Extensions").find("permessage-deflate") != std::string::npos;
+}
+
+// A Client that plays back the first connection in a capture file (see
+// capture.h) instead of connecting to a server, so that the handling of
+// incoming messages can be measured against real traffic. The captured bytes
+// go through the same handshake and frame parsing (and permessage-deflate, if
+// the capture used it) as bytes from a socket, and the same handlers are
+// called.
+//
+// run(), on the background thread, answers the client's opening handshake
+// with the captured response (with a Sec-WebSocket-Accept for the new key),
+// and then feeds in the captured reads at their original times, divided by
+// `speed`. Calls from the main thread that touch the connection, like send()
+// and close(), are posted to run(), as asio would post them to the
+// io_service. Messages that are sent are discarded. At the end of the
+// capture, the connection ends as if the server had gone away; if close() is
+// called first, the server's reply to the close frame is simulated.
+template <class T>
+class ReplayClient : public ClientBase<T> {
+
+public:
+  ReplayClient(shared_ptr<CaptureReader> reader, double speed)
+    : reader(reader), speed(speed) {}
+
+  void init_asio() {}
+  void init_asio(ws_websocketpp::lib::asio::io_service* io_service) {
+    throw std::runtime_error("Can't use a shared io_service for replay.");
+  }
+  void set_tls_init_handler(ws_websocketpp::transport::asio::tls_socket::tls_init_handler h) {
+    throw std::runtime_error("Can't set TLS init handler for replay.");
+  }
+  void set_socket_init_handler(ws_websocketpp::transport::asio::tls_socket::socket_init_handler h) {
+    throw std::runtime_error("Can't set TLS socket init handler for replay.");
+  }
+  // A replay doesn't resolve anything.
+  void set_resolve_cache(ws_websocketpp::transport::asio::resolve_cache* cache) {}
+
+  // There is no TLS in a replay, so a wss:// location is treated as ws://.
+  void setup_connection(std::string location, ws_websocketpp::lib::error_code &ec) {
+    if (location.compare(0, 6, "wss://") == 0) {
+      location = "ws://" + location.substr(6);
+    }
+    ClientBase<T>::setup_connection(location, ec);
+    if (!ec) {
+      this->con->set_write_handler(bind(&ReplayClient::handleWrite, this, ::_1, ::_2, ::_3));
+    }
+  }
+
+  void connect() {
+    post(bind(&ReplayClient::start, this));
+  }
+  void reconnect(ws_websocketpp::lib::error_code &ec) {
+    ec = ws_websocketpp::error::make_error_code(ws_websocketpp::error::invalid_state);
+  }
+
+  std::size_t run();
+  // Not used; run() does all of the work.
+  std::size_t run_one() {
+    return 0;
+  }
+  std::size_t poll() {
+    return 0;
+  }
+  ws_websocketpp::lib::asio::io_service& get_io_service() {
+    return ioService;
+  }
+
+  void send(std::string const& payload, ws_websocketpp::frame::opcode::value op) {
+    post(bind(&ReplayClient::sendPayload, this, payload, op));
+  }
+  void send(void const* payload, size_t len, ws_websocketpp::frame::opcode::value op) {
+    std::string copy(static_cast<char const*>(payload), len);
+    post(bind(&ReplayClient::sendPayload, this, copy, op));
+  }
+  void send_many(std::vector<message_ptr> const& msgs) {
+    post(bind(&ReplayClient::sendMessages, this, msgs));
+  }
+  void reset() {}
+  void close(ws_websocketpp::close::status::value const code, std::string const& reason) {
+    post(bind(&ReplayClient::closeConnection, this, code, reason));
+  }
+  void stop() {
+    lock_guard<mutex> lock(taskMutex);
+    stopping = true;
+    taskCond.notify_one();
+  }
+  bool stopped() {
+    return !this->con || this->con->get_state() == ws_websocketpp::session::state::closed;
+  }
+  void resume_reading() {
+    post(bind(&ReplayClient::resume, this));
+  }
+
+private:
+  typedef std::chrono::steady_clock clock;
+
+  shared_ptr<CaptureReader> reader;
+  double speed;
+  // Only for get_io_service(); nothing is run on it.
+  ws_websocketpp::lib::asio::io_service ioService;
+
+  // Work posted from other threads, for run(). These are protected by
+  // taskMutex.
+  mutex taskMutex;
+  ws_websocketpp::lib::condition_variable taskCond;
+  std::vector<ws_websocketpp::lib::function<void()>> tasks;
+  bool stopping = false;
+
+  // The rest of the values are touched only in run(), on the background
+  // thread. `input` holds the bytes being fed in, of which `offset` have
+  // been accepted so far, and which are due to arrive at `due`.
+  bool started = false;
+  bool answered = false;
+  bool atEnd = false;
+  std::string request;
+  std::string input;
+  size_t offset = 0;
+  clock::time_point due;
+  clock::time_point replayStart;
+
+  void post(ws_websocketpp::lib::function<void()> task) {
+    lock_guard<mutex> lock(taskMutex);
+    tasks.push_back(task);
+    taskCond.notify_one();
+  }
+  bool hasTasks() {
+    lock_guard<mutex> lock(taskMutex);
+    return !tasks.empty();
+  }
+
+  clock::time_point feed();
+  bool nextInput();
+  void start();
+  std::string handshakeResponse();
+
+  // Until the handshake has been answered, collect the request, for its
+  // Sec-WebSocket-Key. Everything written after that is dropped.
+  ws_websocketpp::lib::error_code handleWrite(ws_websocketpp::connection_hdl, char const* buf, size_t len) {
+    if (!answered) {
+      request.append(buf, len);
+    }
+    return ws_websocketpp::lib::error_code();
+  }
+
+  void sendPayload(std::string const& payload, ws_websocketpp::frame::opcode::value op) {
+    this->con->send(payload, op);
+  }
+  void sendMessages(std::vector<message_ptr> const& msgs) {
+    this->con->send_many(msgs);
+  }
+  void resume() {
+    this->con->resume_reading();
+  }
+  void closeConnection(ws_websocketpp::close::status::value code, std::string const& reason) {
+    ws_websocketpp::lib::error_code ec;
+    this->con->close(code, reason, ec);
+    if (ec) {
+      return;
+    }
+    // Answer with the server's close frame, and then end the stream, as the
+    // server would.
+    input = std::string("\x88\x02", 2);
+    input += static_cast<char>((code >> 8) & 0xFF);
+    input += static_cast<char>(code & 0xFF);
+    offset = 0;
+    due = clock::now();
+    atEnd = true;
+  }
+};
+
+template <class T>
+std::size_t ReplayClient<T>::run() {
+  ws_websocketpp::lib::unique_lock<mutex> lock(taskMutex);
+  while (!stopping) {
+    if (!tasks.empty()) {
+      std::vector<ws_websocketpp::lib::function<void()>> ready;
+      ready.swap(tasks);
+      lock.unlock();
+      for (size_t i = 0; i < ready.size(); i++) {
+        ready[i]();
+      }
+      lock.lock();
+      continue;
+    }
+    if (started && stopped()) {
+      break;
+    }
+
+    clock::time_point wait = clock::time_point::max();
+    if (started) {
+      lock.unlock();
+      wait = feed();
+      lock.lock();
+    }
+    if (tasks.empty() && !stopping && !(started && stopped())) {
+      if (wait == clock::time_point::max()) {
+        taskCond.wait(lock);
+      } else if (wait > clock::now()) {
+        taskCond.wait_until(lock, wait);
+      }
+    }
+  }
+  return 0;
+}
+
+// Feed in captured bytes that are due. Returns when the connection needs to
+// wait: until the time returned, for the next bytes to be due, or (when the
+// time returned is time_point::max()) for a task, such as resuming reading.
+template <class T>
+typename ReplayClient<T>::clock::time_point ReplayClient<T>::feed() {
+  while (true) {
+    if (offset == input.size()) {
+      if (atEnd) {
+        // This does nothing if reading is paused, in which case it's tried
+        // again after reading resumes.
+        this->con->eof();
+        return clock::time_point::max();
+      }
+      if (!nextInput()) {
+        atEnd = true;
+        continue;
+      }
+    }
+    if (clock::now() < due) {
+      return due;
+    }
+    size_t n = this->con->read_some(input.data() + offset, input.size() - offset);
+    offset += n;
+    if (n == 0) {
+      // Reading is paused, or the connection has ended.
+      return clock::time_point::max();
+    }
+    if (hasTasks()) {
+      return clock::now();
+    }
+  }
+}
+
+// Move to the next captured read. Returns false at the end of the first
+// connection in the file.
+template <class T>
+bool ReplayClient<T>::nextInput() {
+  CaptureRecord record;
+  while (reader->next(&record)) {
+    if (record.type == CAPTURE_OPEN) {
+      return false;
+    }
+    if (record.type != CAPTURE_DATA) {
+      continue;
+    }
+    input.swap(record.data);
+    offset = 0;
+    due = replayStart;
+    if (std::isfinite(speed)) {
+      uint64_t elapsed = record.time - reader->openRecord().time;
+      due += std::chrono::duration_cast<clock::duration>(
+        std::chrono::nanoseconds(static_cast<int64_t>(elapsed / speed))
+      );
+    }
+    return true;
+  }
+  return false;
+}
+
+// Send the opening handshake, and queue the captured response as the first
+// input.
+template <class T>
+void ReplayClient<T>::start() {
+  this->client.connect(this->con);
+  started = true;
+  input = handshakeResponse();
+  answered = true;
+  offset = 0;
+  replayStart = clock::now();
+  due = replayStart;
+}
+
+// The captured handshake response, with the Sec-WebSocket-Accept header
+// changed to match the key in this connection's request.
+template <class T>
+std::string ReplayClient<T>::handshakeResponse() {
+  ws_websocketpp::http::parser::request req;
+  ws_websocketpp::http::parser::response res;
+  try {
+    req.consume(request.data(), request.size());
+    const std::string& captured = reader->openRecord().data;
+    res.consume(captured.data(), captured.size());
+  } catch (const ws_websocketpp::http::exception&) {
+    // The client will fail the handshake.
+    return std::string();
+  }
+  std::string key = req.get_header("Sec-WebSocket-Key") +
+    ws_websocketpp::processor::constants::handshake_guid;
+  unsigned char digest[20];
+  ws_websocketpp::sha1::calc(key.c_str(), key.length(), digest);
+  res.replace_header("Sec-WebSocket-Accept", ws_websocketpp::base64_encode(digest, 20));
+  return res.raw();
+}
+
+#endif
@@ -0,0 +1,138 @@
+#include "stats.h"
+#include <algorithm>
+#include <cmath>
+
+double microsSince(StatsClock::time_point start) {
+  return std::chrono::duration<double, std::micro>(StatsClock::now() - start).count();
+}
+
+void Histogram::add(double micros, uint64_t n) {
+  size_t i = 0;
+  if (micros >= 1) {
+    int exp;
+    std::frexp(micros, &exp);  // 2^(exp-1) <= micros < 2^exp
+    i = std::min<size_t>(exp, nBuckets - 1);
+  }
+  buckets[i].add(n);
+}
+
+std::vector<uint64_t> Histogram::counts() const {
+  std::vector<uint64_t> result(nBuckets);
+  for (size_t i = 0; i < nBuckets; i++) {
+    result[i] = buckets[i].get();
+  }
+  return result;
+}
+
+std::vector<double> Histogram::bounds() {
+  std::vector<double> result(nBuckets);
+  for (size_t i = 0; i < nBuckets - 1; i++) {
+    result[i] = std::ldexp(1.0, i);
+  }
+  result[nBuckets - 1] = INFINITY;
+  return result;
+}
+
+
+void ConnectionStats::messagesIn(uint64_t n, uint64_t bytes) {
+  nMessagesIn.add(n);
+  nBytesIn.add(bytes);
+  if (parent) parent->messagesIn(n, bytes);
+}
+
+void ConnectionStats::messagesOut(uint64_t n, uint64_t bytes) {
+  nMessagesOut.add(n);
+  nBytesOut.add(bytes);
+  if (parent) parent->messagesOut(n, bytes);
+}
+
+void ConnectionStats::framesIn(uint64_t n) {
+  nFramesIn.add(n);
+  if (parent) parent->framesIn(n);
+}
+
+void ConnectionStats::framesOut(uint64_t n, uint64_t dataFrames) {
+  nFramesOut.add(n);
+  nMessagesWritten.add(dataFrames);
+  if (parent) parent->framesOut(n, dataFrames);
+}
+
+void ConnectionStats::reconnect() {
+  nReconnects.add(1);
+  if (parent) parent->reconnect();
+}
+
+void ConnectionStats::dispatched(double micros, uint64_t n) {
+  dispatchLatency.add(micros, n);
+  if (parent) parent->dispatched(micros, n);
+}
+
+void ConnectionStats::written(double micros, uint64_t n) {
+  writeLatency.add(micros, n);
+  if (parent) parent->written(micros, n);
+}
+
+void ConnectionStats::unsent(uint64_t n) {
+  nMessagesUnsent.add(n);
+  if (parent) parent->unsent(n);
+}
+
+void ConnectionStats::discarded(uint64_t n) {
+  nMessagesDiscarded.add(n);
+  if (parent) parent->discarded(n);
+}
+
+void ConnectionStats::filtered(uint64_t n) {
+  nMessagesFiltered.add(n);
+  if (parent) parent->filtered(n);
+}
+
+void ConnectionStats::conflated(uint64_t n) {
+  nMessagesConflated.add(n);
+  if (parent) parent->conflated(n);
+}
+
+ConnectionStats& globalStats() {
+  static ConnectionStats stats;
+  return stats;
+}
+
+
+void SendTimes::push(uint64_t n) {
+  lock_guard<mutex> lock(timesMutex);
+  times.push_back(std::make_pair(StatsClock::now(), n));
+}
+
+void SendTimes::cancel() {
+  lock_guard<mutex> lock(timesMutex);
+  // The entry from push() is still at the back, since none of its messages
+  // were queued, and so none can have been written.
+  if (!times.empty()) {
+    times.pop_back();
+  }
+}
+
+void SendTimes::written(uint64_t n, ConnectionStats& stats) {
+  StatsClock::time_point now = StatsClock::now();
+  lock_guard<mutex> lock(timesMutex);
+  while (n > 0 && !times.empty()) {
+    std::pair<StatsClock::time_point, uint64_t>& front = times.front();
+    uint64_t k = std::min(n, front.second);
+    stats.written(std::chrono::duration<double, std::micro>(now - front.first).count(), k);
+    n -= k;
+    front.second -= k;
+    if (front.second == 0) {
+      times.pop_front();
+    }
+  }
+}
+
+uint64_t SendTimes::clear() {
+  lock_guard<mutex> lock(timesMutex);
+  uint64_t n = 0;
+  for (size_t i = 0; i < times.size(); i++) {
+    n += times[i].second;
+  }
+  times.clear();
+  return n;
+}
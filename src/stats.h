@@ -0,0 +1,121 @@
+#ifndef STATS_HPP
+#define STATS_HPP
+
+#include "websocket_defs.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <utility>
+#include <vector>
+
+typedef std::chrono::steady_clock StatsClock;
+
+// Microseconds from `start` until now.
+double microsSince(StatsClock::time_point start);
+
+// A counter that can be updated and read from any thread without locking.
+class Counter {
+public:
+  Counter() : value(0) {}
+  void add(uint64_t n) { value.fetch_add(n, std::memory_order_relaxed); }
+  uint64_t get() const { return value.load(std::memory_order_relaxed); }
+
+private:
+  std::atomic<uint64_t> value;
+};
+
+// Counts of durations in power-of-two buckets. Bucket 0 counts durations of
+// less than 1 microsecond, bucket i (for i > 0) counts durations of at least
+// 2^(i-1) and less than 2^i microseconds, and the last bucket also counts
+// everything longer.
+class Histogram {
+public:
+  static const size_t nBuckets = 28;  // The last bucket starts at about 67 s
+
+  void add(double micros, uint64_t n = 1);
+  std::vector<uint64_t> counts() const;
+
+  // The upper bound of each bucket, in microseconds.
+  static std::vector<double> bounds();
+
+private:
+  Counter buckets[nBuckets];
+};
+
+// Counters for a connection. Each update is also applied to the parent, if
+// there is one, so that the process-wide totals (see globalStats()) are kept
+// without any locking.
+class ConnectionStats {
+public:
+  explicit ConnectionStats(ConnectionStats* parent = NULL) : parent(parent) {}
+
+  void messagesIn(uint64_t n, uint64_t bytes);
+  void messagesOut(uint64_t n, uint64_t bytes);
+  void framesIn(uint64_t n);
+  void framesOut(uint64_t n, uint64_t dataFrames);
+  void reconnect();
+  // A message was dropped by a filter before reaching R.
+  void filtered(uint64_t n);
+  // A message waiting to be passed to R was replaced by a newer one with the
+  // same key (see ConflationKey).
+  void conflated(uint64_t n);
+  // A message was passed to R, `micros` after it was read from the socket.
+  void dispatched(double micros, uint64_t n = 1);
+  // A message was written to the socket, `micros` after it was sent.
+  void written(double micros, uint64_t n = 1);
+  // A message was sent, but the connection ended before it was written.
+  void unsent(uint64_t n);
+  // A message was read, but the connection was deleted before it was passed
+  // to R.
+  void discarded(uint64_t n);
+
+  Counter nMessagesIn;
+  Counter nBytesIn;
+  Counter nMessagesOut;
+  Counter nBytesOut;
+  Counter nFramesIn;
+  Counter nFramesOut;
+  // Data frames written. With nMessagesOut and nMessagesUnsent, this gives
+  // the number of messages that are queued but not yet written.
+  Counter nMessagesWritten;
+  Counter nMessagesUnsent;
+  Counter nMessagesDiscarded;
+  Counter nReconnects;
+  Counter nMessagesFiltered;
+  Counter nMessagesConflated;
+  Histogram dispatchLatency;
+  Histogram writeLatency;
+
+private:
+  ConnectionStats* parent;
+};
+
+// Totals for all connections in the process.
+ConnectionStats& globalStats();
+
+// The times at which messages were queued for sending, oldest first, so that
+// the time each one takes to be written can be measured. Messages are written
+// in the order they're queued.
+class SendTimes {
+public:
+  // Call on the main thread before queueing n messages, and cancel() if
+  // queueing them fails.
+  void push(uint64_t n);
+  void cancel();
+
+  // Call on the background thread after n messages have been written.
+  // Records the time each of them took in stats.
+  void written(uint64_t n, ConnectionStats& stats);
+
+  // Call on the main thread after the connection has ended, so that the
+  // messages that were never written aren't matched with writes made by a
+  // later connection. Returns the number of messages forgotten.
+  uint64_t clear();
+
+private:
+  mutex timesMutex;
+  std::deque<std::pair<StatsClock::time_point, uint64_t>> times;
+};
+
+#endif
@@ -0,0 +1,192 @@
+#include <map>
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+#include "cpp11.hpp"
+#include "tls.h"
+#include "debug.h"
+
+// These are protected by tlsMutex.
+static mutex tlsMutex;
+static TlsOptions tlsOptions;
+static context_ptr sharedContext;
+
+// What belongs to one shared context: the options it was built with, and the
+// sessions cached from its connections. It's kept in the SSL_CTX's ex_data,
+// so that each connection uses the settings and sessions of the context it
+// was created with, and a context that has been replaced can't put sessions
+// in the cache of the new one. It is deleted along with the SSL_CTX.
+struct TlsContextState {
+  TlsOptions options;
+  mutex sessionMutex;
+  std::map<std::string, SSL_SESSION*> sessionCache;
+
+  ~TlsContextState() {
+    std::map<std::string, SSL_SESSION*>::iterator it;
+    for (it = sessionCache.begin(); it != sessionCache.end(); ++it) {
+      SSL_SESSION_free(it->second);
+    }
+  }
+};
+
+// Index of the SSL_CTX ex_data slot that holds each context's
+// TlsContextState. Set on the main thread, before the first context is used,
+// like sessionKeyIndex.
+static int contextStateIndex = -1;
+
+static void freeContextState(void*, void* ptr, CRYPTO_EX_DATA*, int, long, void*) {
+  delete static_cast<TlsContextState*>(ptr);
+}
+
+static TlsContextState* contextState(SSL* ssl) {
+  return static_cast<TlsContextState*>(
+    SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), contextStateIndex)
+  );
+}
+
+// Index of the SSL ex_data slot that holds the session cache key (a heap
+// allocated std::string) for each SSL object.
+static int sessionKeyIndex = -1;
+
+static void freeSessionKey(void*, void* ptr, CRYPTO_EX_DATA*, int, long, void*) {
+  delete static_cast<std::string*>(ptr);
+}
+
+// Called by OpenSSL on the I/O thread when the server hands out a new session.
+// Returning 1 means we keep the reference to the session.
+static int onNewSession(SSL* ssl, SSL_SESSION* session) {
+  std::string* key = static_cast<std::string*>(SSL_get_ex_data(ssl, sessionKeyIndex));
+  TlsContextState* state = contextState(ssl);
+  if (key == NULL || state == NULL) {
+    return 0;
+  }
+
+  lock_guard<mutex> lock(state->sessionMutex);
+  std::map<std::string, SSL_SESSION*>::iterator it = state->sessionCache.find(*key);
+  if (it != state->sessionCache.end()) {
+    SSL_SESSION_free(it->second);
+    it->second = session;
+  } else {
+    state->sessionCache[*key] = session;
+  }
+  return 1;
+}
+
+static context_ptr buildContext(const TlsOptions& options) {
+  context_ptr ctx = make_shared<asio::ssl::context>(asio::ssl::context::sslv23);
+  try {
+    ctx->set_options(asio::ssl::context::default_workarounds |
+      asio::ssl::context::no_sslv2 |
+      asio::ssl::context::no_sslv3 |
+      asio::ssl::context::single_dh_use);
+
+    if (options.verifyPeer) {
+      ctx->set_verify_mode(asio::ssl::verify_peer);
+      if (options.caFile.empty() && options.caPath.empty()) {
+        ctx->set_default_verify_paths();
+      }
+    }
+    if (!options.caFile.empty()) {
+      ctx->load_verify_file(options.caFile);
+    }
+    if (!options.caPath.empty()) {
+      ctx->add_verify_path(options.caPath);
+    }
+    if (!options.ciphers.empty() &&
+        SSL_CTX_set_cipher_list(ctx->native_handle(), options.ciphers.c_str()) != 1) {
+      throw std::runtime_error("no valid ciphers in cipher list");
+    }
+    if (!options.certFile.empty()) {
+      ctx->use_certificate_chain_file(options.certFile);
+    }
+    if (!options.keyFile.empty()) {
+      ctx->use_private_key_file(options.keyFile, asio::ssl::context::pem);
+    }
+
+    if (contextStateIndex < 0) {
+      contextStateIndex = SSL_CTX_get_ex_new_index(0, NULL, NULL, NULL, freeContextState);
+      sessionKeyIndex = SSL_get_ex_new_index(0, NULL, NULL, NULL, freeSessionKey);
+    }
+    TlsContextState* state = new TlsContextState();
+    state->options = options;
+    SSL_CTX_set_ex_data(ctx->native_handle(), contextStateIndex, state);
+
+    if (options.sessionResumption) {
+      // Client-side caching is done in the context's sessionCache, keyed by
+      // host, rather than in OpenSSL's internal store.
+      SSL_CTX_set_session_cache_mode(ctx->native_handle(),
+        SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+      SSL_CTX_sess_set_new_cb(ctx->native_handle(), onNewSession);
+    }
+  } catch (std::exception &e) {
+    cpp11::stop(std::string("Error in context pointer: ") + e.what() + "\n");
+  }
+  return ctx;
+}
+
+void tlsConfigure(const TlsOptions& options) {
+  ASSERT_MAIN_THREAD()
+  // Build before taking the lock; this can throw an R error.
+  context_ptr ctx = buildContext(options);
+
+  lock_guard<mutex> lock(tlsMutex);
+  tlsOptions = options;
+  sharedContext = ctx;
+}
+
+context_ptr tlsContext() {
+  ASSERT_MAIN_THREAD()
+  TlsOptions options;
+  {
+    lock_guard<mutex> lock(tlsMutex);
+    if (sharedContext) {
+      return sharedContext;
+    }
+    options = tlsOptions;
+  }
+
+  context_ptr ctx = buildContext(options);
+
+  lock_guard<mutex> lock(tlsMutex);
+  if (!sharedContext) {
+    sharedContext = ctx;
+  }
+  return sharedContext;
+}
+
+context_ptr tlsInitHandler() {
+  lock_guard<mutex> lock(tlsMutex);
+  return sharedContext;
+}
+
+void tlsInitSocket(
+  const std::string& sessionKey,
+  const std::string& host,
+  asio::ssl::stream<asio::ip::tcp::socket>& socket
+) {
+  SSL* ssl = socket.native_handle();
+  TlsContextState* state = contextState(ssl);
+  if (state == NULL) {
+    return;
+  }
+
+  // Use the options this connection's context was built with, which may not
+  // be the current ones.
+  const TlsOptions& options = state->options;
+  if (options.verifyPeer) {
+    X509_VERIFY_PARAM* param = SSL_get0_param(ssl);
+    // The host may be an IP address literal rather than a DNS name.
+    if (X509_VERIFY_PARAM_set1_ip_asc(param, host.c_str()) != 1) {
+      X509_VERIFY_PARAM_set1_host(param, host.c_str(), 0);
+    }
+  }
+
+  if (options.sessionResumption) {
+    SSL_set_ex_data(ssl, sessionKeyIndex, new std::string(sessionKey));
+
+    lock_guard<mutex> lock(state->sessionMutex);
+    std::map<std::string, SSL_SESSION*>::iterator it = state->sessionCache.find(sessionKey);
+    if (it != state->sessionCache.end()) {
+      SSL_set_session(ssl, it->second);
+    }
+  }
+}
@@ -0,0 +1,50 @@
+#ifndef TLS_HPP
+#define TLS_HPP
+
+#include "websocket_defs.h"
+#include <string>
+
+// All wss:// connections share one process-wide asio::ssl::context, instead of
+// each building (and loading CA certificates into) its own. The context is
+// rebuilt only when the TLS options are changed with tlsConfigure(). Each
+// connection gets the context when it connects, and keeps using it, and the
+// options it was built with, after the context is replaced.
+//
+// When session resumption is enabled, TLS sessions (session IDs or session
+// tickets) that servers hand out are cached per host:port, and offered to the
+// server the next time a connection is made to the same host and port, so that
+// reconnects can skip the full handshake. Each context has its own cache, so
+// sessions are only resumed with the options they were made with.
+
+struct TlsOptions {
+  std::string caFile;
+  std::string caPath;
+  std::string ciphers;
+  std::string certFile;
+  std::string keyFile;
+  bool verifyPeer = false;
+  bool sessionResumption = true;
+};
+
+// Replace the TLS options and rebuild the shared context, which starts with an
+// empty session cache. Must be called from the main thread.
+void tlsConfigure(const TlsOptions& options);
+
+// Return the shared context, building it with the current options if it
+// hasn't been built yet. Must be called from the main thread.
+context_ptr tlsContext();
+
+// tls_init_handler for wss:// connections. Returns the shared context without
+// building it; safe to call from any thread.
+context_ptr tlsInitHandler();
+
+// socket_init_handler for wss:// connections: sets up peer name verification
+// and offers a cached session for sessionKey (host:port), if there is one,
+// according to the options of the socket's context.
+void tlsInitSocket(
+  const std::string& sessionKey,
+  const std::string& host,
+  asio::ssl::stream<asio::ip::tcp::socket>& socket
+);
+
+#endif
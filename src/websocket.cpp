@@ -10,6 +10,7 @@
 #endif // _WIN32
 
 
+#include <cmath>
 #include <iostream>
 #include "cpp11.hpp"
 #include "wrapped_print.h"
@@ -18,6 +19,10 @@
 #include "websocket_defs.h"
 #include "websocket_task.h"
 #include "websocket_connection.h"
+#include "tls.h"
+#include "io_pool.h"
+#include "dns_cache.h"
+#include "stats.h"
 #include "debug.h"
 
 
@@ -53,16 +58,25 @@ SEXP wsCreate(
   cpp11::environment robjPrivate,
   cpp11::strings accessLogChannels,
   cpp11::strings errorLogChannels,
-  int maxMessageSize
+  int maxMessageSize,
+  bool batchMessages,
+  bool sharedIo,
+  int ioThreads,
+  cpp11::list compression,
+  cpp11::list replay
 ) {
   REGISTER_MAIN_THREAD()
   WebsocketConnection* wsc = new WebsocketConnection(
-    uri, loop_id, robjPublic, robjPrivate, accessLogChannels, errorLogChannels, maxMessageSize
+    uri, loop_id, robjPublic, robjPrivate, accessLogChannels, errorLogChannels, maxMessageSize,
+    batchMessages, sharedIo, ioThreads, compression, replay
   );
 
-  shared_ptr<WebsocketConnection> *wsc_pp = new shared_ptr<WebsocketConnection>(wsc);
+  shared_ptr<WebsocketConnection> *wsc_pp = new shared_ptr<WebsocketConnection>(
+    wsc, &WebsocketConnection::deleteOnMainThread
+  );
   SEXP wsc_xptr = PROTECT(R_MakeExternalPtr(wsc_pp, R_NilValue, R_NilValue));
   R_RegisterCFinalizerEx(wsc_xptr, wsc_deleter, TRUE);
+  (*wsc_pp)->setupConnection(compression);
   UNPROTECT(1);
   return wsc_xptr;
 }
@@ -84,6 +98,140 @@ void wsAddProtocols(SEXP wsc_xptr, cpp11::strings protocols) {
   }
 }
 
+[[cpp11::register]]
+void wsSetWriteCoalescing(SEXP wsc_xptr, double maxBytes, int maxFrames, int flushDelay) {
+  ASSERT_MAIN_THREAD()
+  shared_ptr<WebsocketConnection> wsc = xptrGetWsConn(wsc_xptr);
+  wsc->client->set_write_coalescing(maxBytes, maxFrames, flushDelay);
+}
+
+[[cpp11::register]]
+void wsSetWaterMarks(SEXP wsc_xptr, double high, double low) {
+  ASSERT_MAIN_THREAD()
+  shared_ptr<WebsocketConnection> wsc = xptrGetWsConn(wsc_xptr);
+  wsc->setWaterMarks(high, low);
+}
+
+[[cpp11::register]]
+void wsSetMaxBacklog(SEXP wsc_xptr, double messages, double bytes) {
+  ASSERT_MAIN_THREAD()
+  shared_ptr<WebsocketConnection> wsc = xptrGetWsConn(wsc_xptr);
+  wsc->setMaxBacklog(messages, bytes);
+}
+
+[[cpp11::register]]
+void wsSetStreamChunkSize(SEXP wsc_xptr, double size) {
+  ASSERT_MAIN_THREAD()
+  shared_ptr<WebsocketConnection> wsc = xptrGetWsConn(wsc_xptr);
+  wsc->setStreamChunkSize(size);
+}
+
+[[cpp11::register]]
+void wsSetKeepalive(SEXP wsc_xptr, int interval, int timeout) {
+  ASSERT_MAIN_THREAD()
+  shared_ptr<WebsocketConnection> wsc = xptrGetWsConn(wsc_xptr);
+  wsc->setKeepalive(interval, timeout);
+}
+
+[[cpp11::register]]
+void wsSetReconnect(SEXP wsc_xptr, int maxAttempts, double initialDelay, double maxDelay) {
+  ASSERT_MAIN_THREAD()
+  shared_ptr<WebsocketConnection> wsc = xptrGetWsConn(wsc_xptr);
+  wsc->setReconnect(maxAttempts, initialDelay, maxDelay);
+}
+
+[[cpp11::register]]
+void wsSetRawTextSize(SEXP wsc_xptr, double size) {
+  ASSERT_MAIN_THREAD()
+  shared_ptr<WebsocketConnection> wsc = xptrGetWsConn(wsc_xptr);
+  wsc->setRawTextSize(size);
+}
+
+[[cpp11::register]]
+void wsSetParseJson(SEXP wsc_xptr, bool simplifyVector) {
+  ASSERT_MAIN_THREAD()
+  shared_ptr<WebsocketConnection> wsc = xptrGetWsConn(wsc_xptr);
+  wsc->setParseJson(simplifyVector);
+}
+
+// `start` and `length` are only used with the "bytes" type, and `pattern`
+// only with the others.
+[[cpp11::register]]
+void wsSetConflation(SEXP wsc_xptr, std::string type, std::string pattern,
+                     double start, double length) {
+  ASSERT_MAIN_THREAD()
+  shared_ptr<WebsocketConnection> wsc = xptrGetWsConn(wsc_xptr);
+  ConflationKey::KeyType keyType;
+  if (type == "bytes") {
+    keyType = ConflationKey::KEY_BYTES;
+  } else if (type == "json") {
+    keyType = ConflationKey::KEY_JSON;
+  } else if (type == "regex") {
+    keyType = ConflationKey::KEY_REGEX;
+  } else {
+    cpp11::stop("Unknown conflation key type: %s", type.c_str());
+  }
+  shared_ptr<const ConflationKey> key;
+  try {
+    key = make_shared<const ConflationKey>(keyType, pattern, start, length);
+  } catch (const std::regex_error& e) {
+    cpp11::stop("Invalid conflation regex: %s", e.what());
+  }
+  wsc->setConflation(key);
+}
+
+[[cpp11::register]]
+void wsSetCapture(SEXP wsc_xptr, std::string path) {
+  ASSERT_MAIN_THREAD()
+  shared_ptr<WebsocketConnection> wsc = xptrGetWsConn(wsc_xptr);
+  shared_ptr<CaptureWriter> writer;
+  try {
+    writer = make_shared<CaptureWriter>(path);
+  } catch (const std::runtime_error& e) {
+    cpp11::stop(e.what());
+  }
+  wsc->setCapture(writer);
+}
+
+[[cpp11::register]]
+int wsAddFilter(SEXP wsc_xptr, std::string type, std::string pattern, bool hasValue,
+                std::string value, bool drop, std::string topic) {
+  ASSERT_MAIN_THREAD()
+  shared_ptr<WebsocketConnection> wsc = xptrGetWsConn(wsc_xptr);
+  MessageFilter::Rule rule;
+  if (type == "all") {
+    rule.type = MessageFilter::MATCH_ALL;
+  } else if (type == "prefix") {
+    rule.type = MessageFilter::MATCH_PREFIX;
+  } else if (type == "contains") {
+    rule.type = MessageFilter::MATCH_CONTAINS;
+  } else if (type == "json") {
+    rule.type = MessageFilter::MATCH_JSON;
+  } else {
+    cpp11::stop("Unknown filter type: %s", type.c_str());
+  }
+  rule.pattern = pattern;
+  rule.hasValue = hasValue;
+  rule.value = value;
+  rule.drop = drop;
+  rule.topic = topic;
+  return wsc->filter.add(rule);
+}
+
+[[cpp11::register]]
+void wsRemoveFilter(SEXP wsc_xptr, int id) {
+  ASSERT_MAIN_THREAD()
+  shared_ptr<WebsocketConnection> wsc = xptrGetWsConn(wsc_xptr);
+  wsc->filter.remove(id);
+}
+
+[[cpp11::register]]
+void wsCallbacksChanged(SEXP wsc_xptr, std::string name) {
+  ASSERT_MAIN_THREAD()
+  shared_ptr<WebsocketConnection> wsc = xptrGetWsConn(wsc_xptr);
+  wsc->callbacksChanged(name);
+}
+
 [[cpp11::register]]
 void wsConnect(SEXP wsc_xptr) {
   ASSERT_MAIN_THREAD()
@@ -91,14 +239,35 @@ void wsConnect(SEXP wsc_xptr) {
 
   wsc->client->connect();
 
+  if (wsc->sharedIo) {
+    // The connection's I/O is already being run by the IoPool threads.
+    wsc->keepAlive = wsc;
+    return;
+  }
+
   // Starts a new thread in which WebsocketTask::execute is called. Object is
   // automatically deleted when thread stops.
   WebsocketTask* wst = new WebsocketTask(wsc);
   wst->begin();
 }
 
+// Queue n messages, with a total payload of `bytes`, by calling queue(), and
+// count them in the connection's stats. The send time is recorded first, since
+// the messages may be written before queue() returns.
+template <typename F>
+static void queueMessages(shared_ptr<WebsocketConnection> wsc, size_t n, size_t bytes, F queue) {
+  wsc->sendTimes.push(n);
+  try {
+    queue();
+  } catch (...) {
+    wsc->sendTimes.cancel();
+    throw;
+  }
+  wsc->stats.messagesOut(n, bytes);
+}
+
 [[cpp11::register]]
-void wsSend(SEXP wsc_xptr, SEXP msg) {
+bool wsSend(SEXP wsc_xptr, SEXP msg) {
   ASSERT_MAIN_THREAD()
   shared_ptr<WebsocketConnection> wsc = xptrGetWsConn(wsc_xptr);
 
@@ -106,20 +275,207 @@ void wsSend(SEXP wsc_xptr, SEXP msg) {
       Rf_length(msg) == 1 &&
       STRING_ELT(msg, 0) != NA_STRING)
   {
-    // TODO: Make sure that message lifetime is long enough
     const char* msg_ptr = CHAR(STRING_ELT(msg, 0));
     int len = Rf_xlength(STRING_ELT(msg, 0));
-    // When send() is called, I believe that the message is immediately
-    // appended to the message buffer, and then the actual sending of the
-    // message is queued. Since a copy of the message is made, it should be
-    // safe if the original msg is cleared before the actual send happens.
-    wsc->client->send(msg_ptr, len, ws_websocketpp::frame::opcode::text);
+    // send() masks (or compresses) the payload straight from the R vector
+    // into the outgoing frame before returning, so the R vector doesn't need
+    // to outlive this call.
+    queueMessages(wsc, 1, len, [&]() {
+      wsc->client->send(msg_ptr, len, ws_websocketpp::frame::opcode::text);
+    });
 
   } else if (TYPEOF(msg) == RAWSXP) {
-    wsc->client->send(RAW(msg), Rf_length(msg), ws_websocketpp::frame::opcode::binary);
+    size_t len = Rf_xlength(msg);
+    queueMessages(wsc, 1, len, [&]() {
+      wsc->client->send(RAW(msg), len, ws_websocketpp::frame::opcode::binary);
+    });
   } else {
     cpp11::stop("msg must be a one-element character vector or a raw vector.");
   }
+  return wsc->checkWaterMarks();
+}
+
+[[cpp11::register]]
+bool wsSendMany(SEXP wsc_xptr, SEXP msgs) {
+  ASSERT_MAIN_THREAD()
+  shared_ptr<WebsocketConnection> wsc = xptrGetWsConn(wsc_xptr);
+
+  // Build all of the messages before queueing any, so that invalid input
+  // doesn't result in a partial send.
+  std::vector<message_ptr> batch;
+  R_xlen_t n = Rf_xlength(msgs);
+  batch.reserve(n);
+  size_t bytes = 0;
+
+  if (TYPEOF(msgs) == STRSXP) {
+    for (R_xlen_t i = 0; i < n; i++) {
+      SEXP s = STRING_ELT(msgs, i);
+      if (s == NA_STRING) {
+        cpp11::stop("msgs must not contain NA.");
+      }
+      size_t len = Rf_xlength(s);
+      message_ptr msg = wsc->client->get_message(ws_websocketpp::frame::opcode::text, len);
+      msg->append_payload(CHAR(s), len);
+      msg->set_compressed(true);
+      batch.push_back(msg);
+      bytes += len;
+    }
+
+  } else if (TYPEOF(msgs) == VECSXP) {
+    for (R_xlen_t i = 0; i < n; i++) {
+      SEXP x = VECTOR_ELT(msgs, i);
+      message_ptr msg;
+      if (TYPEOF(x) == RAWSXP) {
+        size_t len = Rf_xlength(x);
+        msg = wsc->client->get_message(ws_websocketpp::frame::opcode::binary, len);
+        msg->append_payload(RAW(x), len);
+      } else if (TYPEOF(x) == STRSXP && Rf_length(x) == 1 && STRING_ELT(x, 0) != NA_STRING) {
+        size_t len = Rf_xlength(STRING_ELT(x, 0));
+        msg = wsc->client->get_message(ws_websocketpp::frame::opcode::text, len);
+        msg->append_payload(CHAR(STRING_ELT(x, 0)), len);
+      } else {
+        cpp11::stop("Each element of msgs must be a one-element character vector or a raw vector.");
+      }
+      msg->set_compressed(true);
+      batch.push_back(msg);
+      bytes += msg->get_payload().size();
+    }
+
+  } else {
+    cpp11::stop("msgs must be a character vector or a list.");
+  }
+
+  if (!batch.empty()) {
+    queueMessages(wsc, batch.size(), bytes, [&]() {
+      wsc->client->send_many(batch);
+    });
+  }
+  return wsc->checkWaterMarks();
+}
+
+[[cpp11::register]]
+double wsBufferedAmount(SEXP wsc_xptr) {
+  ASSERT_MAIN_THREAD()
+  shared_ptr<WebsocketConnection> wsc = xptrGetWsConn(wsc_xptr);
+  return wsc->client->get_buffered_amount();
+}
+
+[[cpp11::register]]
+cpp11::list wsLatency(SEXP wsc_xptr) {
+  ASSERT_MAIN_THREAD()
+  shared_ptr<WebsocketConnection> wsc = xptrGetWsConn(wsc_xptr);
+  LatencyStats::Summary s = wsc->latency.summary();
+  // The times are NaN until there is a sample; report those as NA.
+  cpp11::writable::list result = {
+    cpp11::as_sexp(std::isnan(s.last) ? NA_REAL : s.last),
+    cpp11::as_sexp(std::isnan(s.min) ? NA_REAL : s.min),
+    cpp11::as_sexp(std::isnan(s.mean) ? NA_REAL : s.mean),
+    cpp11::as_sexp(std::isnan(s.p99) ? NA_REAL : s.p99),
+    cpp11::as_sexp(static_cast<double>(s.count))
+  };
+  result.names() = { "last", "min", "mean", "p99", "count" };
+  return result;
+}
+
+// Builds a named list one element at a time.
+class NamedList {
+public:
+  void add(const char* name, SEXP value) {
+    values.push_back(value);
+    names.push_back(name);
+  }
+  void add(const char* name, double value) {
+    add(name, cpp11::as_sexp(value));
+  }
+  cpp11::list list() {
+    values.names() = names;
+    return values;
+  }
+
+private:
+  cpp11::writable::list values;
+  std::vector<std::string> names;
+};
+
+// A histogram as a list with the upper bound of each bucket (in
+// microseconds) and its count. The R code turns this into a data frame.
+static cpp11::list histogramData(const Histogram& h) {
+  std::vector<uint64_t> counts = h.counts();
+  NamedList result;
+  result.add("upper", cpp11::as_sexp(Histogram::bounds()));
+  result.add("count", cpp11::as_sexp(std::vector<double>(counts.begin(), counts.end())));
+  return result.list();
+}
+
+// Add the counters in stats, which may be for one connection or for the
+// whole process.
+static void addStats(NamedList& result, const ConnectionStats& stats) {
+  // messagesOut is counted after messages are queued, so for a moment it may
+  // be behind the number written.
+  double out = stats.nMessagesOut.get();
+  // Messages that were written, or dropped when their connection ended.
+  double finished = static_cast<double>(stats.nMessagesWritten.get()) +
+    stats.nMessagesUnsent.get();
+  result.add("messagesIn", stats.nMessagesIn.get());
+  result.add("bytesIn", stats.nBytesIn.get());
+  result.add("messagesOut", out);
+  result.add("bytesOut", stats.nBytesOut.get());
+  result.add("framesIn", stats.nFramesIn.get());
+  result.add("framesOut", stats.nFramesOut.get());
+  result.add("sendQueueMessages", out > finished ? out - finished : 0.0);
+  result.add("messagesUnsent", stats.nMessagesUnsent.get());
+  result.add("reconnects", stats.nReconnects.get());
+  result.add("messagesFiltered", stats.nMessagesFiltered.get());
+  result.add("messagesConflated", stats.nMessagesConflated.get());
+  result.add("dispatchLatency", histogramData(stats.dispatchLatency));
+  result.add("writeLatency", histogramData(stats.writeLatency));
+}
+
+[[cpp11::register]]
+cpp11::list wsStats(SEXP wsc_xptr) {
+  ASSERT_MAIN_THREAD()
+  shared_ptr<WebsocketConnection> wsc = xptrGetWsConn(wsc_xptr);
+  size_t backlogMessages, backlogBytes;
+  wsc->getBacklog(&backlogMessages, &backlogBytes);
+
+  NamedList result;
+  addStats(result, wsc->stats);
+  result.add("sendQueueBytes", wsc->client->get_buffered_amount());
+  result.add("backlogMessages", backlogMessages);
+  result.add("backlogBytes", backlogBytes);
+  return result.list();
+}
+
+[[cpp11::register]]
+cpp11::list wsIoStats() {
+  REGISTER_MAIN_THREAD()
+  ConnectionStats& stats = globalStats();
+  NamedList result;
+  addStats(result, stats);
+
+  // Every message read is either passed to R, dropped by a filter, replaced
+  // by a newer one with conflation, discarded with its connection, or still
+  // in a backlog.
+  std::vector<uint64_t> dispatched = stats.dispatchLatency.counts();
+  double delivered = 0;
+  for (size_t i = 0; i < dispatched.size(); i++) {
+    delivered += dispatched[i];
+  }
+  double in = static_cast<double>(stats.nMessagesIn.get()) -
+    stats.nMessagesFiltered.get() - stats.nMessagesConflated.get() -
+    stats.nMessagesDiscarded.get();
+  result.add("backlogMessages", in > delivered ? in - delivered : 0.0);
+  result.add("messagesDiscarded", stats.nMessagesDiscarded.get());
+  result.add("ioThreads", IoPool::instance().size());
+  return result.list();
+}
+
+// Set how long, in seconds, resolved addresses are reused by later connections
+// to the same host. 0 turns off caching.
+[[cpp11::register]]
+void wsSetDnsCacheTtl(double ttl) {
+  REGISTER_MAIN_THREAD()
+  DnsCache::instance().setTtl(static_cast<long>(ttl * 1000));
 }
 
 [[cpp11::register]]
@@ -164,3 +520,25 @@ void wsUpdateLogChannels(
   shared_ptr<WebsocketConnection> wsc = xptrGetWsConn(wsc_xptr);
   wsc->client->update_log_channels(accessOrError, setOrClear, logChannels);
 }
+
+[[cpp11::register]]
+void wsTlsConfig(
+  std::string caFile,
+  std::string caPath,
+  std::string ciphers,
+  std::string certFile,
+  std::string keyFile,
+  bool verifyPeer,
+  bool sessionResumption
+) {
+  REGISTER_MAIN_THREAD()
+  TlsOptions options;
+  options.caFile = caFile;
+  options.caPath = caPath;
+  options.ciphers = ciphers;
+  options.certFile = certFile;
+  options.keyFile = keyFile;
+  options.verifyPeer = verifyPeer;
+  options.sessionResumption = sessionResumption;
+  tlsConfigure(options);
+}
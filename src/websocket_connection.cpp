@@ -1,26 +1,22 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
 #include "cpp11.hpp"
 #include "websocket_defs.h"
 #include "websocket_connection.h"
+#include "io_pool.h"
+#include "dns_cache.h"
+#include "replay_client.hpp"
+#include "tls.h"
 #include "debug.h"
 
 using ws_websocketpp::lib::function;
 using ws_websocketpp::lib::bind;
 
 
-static context_ptr on_tls_init() {
-  ASSERT_MAIN_THREAD()
-  context_ptr ctx = make_shared<asio::ssl::context>(asio::ssl::context::sslv23);
-  try {
-    ctx->set_options(asio::ssl::context::default_workarounds |
-      asio::ssl::context::no_sslv2 |
-      asio::ssl::context::no_sslv3 |
-      asio::ssl::context::single_dh_use);
-  } catch (std::exception &e) {
-    cpp11::stop(std::string("Error in context pointer: ") + e.what() + "\n");
-  }
-  return ctx;
-}
-
 // Invoke a callback and delete the object. The Callback object must have been
 // heap-allocated.
 void invoke_function_callback(void* data) {
@@ -30,16 +26,40 @@ void invoke_function_callback(void* data) {
   delete fun;
 }
 
-// Convert a std::string to a cpp11:raws
-cpp11::raws to_raw(const std::string input) {
-  cpp11::writable::raws rv(input.size());
-  const char* input_c = input.c_str();
-  for(int i=0; i<input.size(); i++) {
-    rv[i] = input_c[i];
+// Convert a std::string to a cpp11::raws. The RAWSXP is allocated once at its
+// final size and filled with a single bulk copy.
+cpp11::raws to_raw(const std::string& input) {
+  cpp11::writable::raws rv(static_cast<R_xlen_t>(input.size()));
+  if (!input.empty()) {
+    std::memcpy(RAW(rv), input.data(), input.size());
   }
   return rv;
 }
 
+// Build the Sec-WebSocket-Extensions offer for permessage-deflate from the
+// options list created by the R code. See RFC 7692, section 7.1.
+static std::string deflateOffer(cpp11::list compression) {
+  int serverMaxWindowBits = cpp11::as_cpp<int>(compression["serverMaxWindowBits"]);
+  int clientMaxWindowBits = cpp11::as_cpp<int>(compression["clientMaxWindowBits"]);
+  std::string offer = "permessage-deflate";
+  if (cpp11::as_cpp<bool>(compression["serverNoContextTakeover"])) {
+    offer += "; server_no_context_takeover";
+  }
+  if (cpp11::as_cpp<bool>(compression["clientNoContextTakeover"])) {
+    offer += "; client_no_context_takeover";
+  }
+  if (serverMaxWindowBits < 15) {
+    offer += "; server_max_window_bits=" + std::to_string(serverMaxWindowBits);
+  }
+  // Always include client_max_window_bits, to tell the server that it may
+  // limit the window we use for compression.
+  offer += "; client_max_window_bits";
+  if (clientMaxWindowBits < 15) {
+    offer += "=" + std::to_string(clientMaxWindowBits);
+  }
+  return offer;
+}
+
 WebsocketConnection::WebsocketConnection(
   std::string uri,
   int loop_id,
@@ -47,12 +67,21 @@ WebsocketConnection::WebsocketConnection(
   cpp11::environment robjPrivate,
   cpp11::strings accessLogChannels,
   cpp11::strings errorLogChannels,
-  int maxMessageSize
+  int maxMessageSize,
+  bool batchMessages,
+  bool sharedIo,
+  int ioThreads,
+  cpp11::list compression,
+  cpp11::list replay
 )
-: uri(uri),
+: stats(&globalStats()),
+  sharedIo(sharedIo),
+  uri(uri),
   loop_id(loop_id),
   robjPublic(robjPublic),
-  robjPrivate(robjPrivate)
+  robjPrivate(robjPrivate),
+  mainThread(std::this_thread::get_id()),
+  batchMessages(batchMessages)
 {
   ASSERT_MAIN_THREAD()
   if (uri.size() < 6) {
@@ -60,12 +89,51 @@ WebsocketConnection::WebsocketConnection(
   }
 
 
-  if (uri.substr(0, 5) == "ws://") {
-    client = make_shared<ClientImpl<ws_client>>();
+  // An empty list means that compression is off.
+  bool deflate = compression.size() > 0;
+
+  // Likewise, an empty list means that this is a real connection, not a
+  // replay of a capture file.
+  if (replay.size() > 0) {
+    if (uri.substr(0, 5) != "ws://" && uri.substr(0, 6) != "wss://") {
+      cpp11::stop("Invalid websocket URI: must begin with ws:// or wss://");
+    }
+    std::string file = cpp11::as_cpp<std::string>(replay["file"]);
+    double speed = cpp11::as_cpp<double>(replay["speed"]);
+    shared_ptr<CaptureReader> reader;
+    try {
+      reader = make_shared<CaptureReader>(file);
+    } catch (const std::runtime_error& e) {
+      cpp11::stop(e.what());
+    }
+    // The extension has to be enabled if the captured connection used it,
+    // whether or not it's offered, or the frames can't be read.
+    if (deflate || replayUsesDeflate(reader->openRecord().data)) {
+      client = make_shared<ReplayClient<ws_replay_deflate_client>>(reader, speed);
+    } else {
+      client = make_shared<ReplayClient<ws_replay_client>>(reader, speed);
+    }
+
+  } else if (uri.substr(0, 5) == "ws://") {
+    if (deflate) {
+      client = make_shared<ClientImpl<ws_deflate_client>>();
+    } else {
+      client = make_shared<ClientImpl<ws_client>>();
+    }
 
   } else if (uri.substr(0, 6) == "wss://") {
-    client = make_shared<ClientImpl<wss_client>>();
-    client->set_tls_init_handler(bind(&on_tls_init));
+    if (deflate) {
+      client = make_shared<ClientImpl<wss_deflate_client>>();
+    } else {
+      client = make_shared<ClientImpl<wss_client>>();
+    }
+    // Build the shared TLS context now, on the main thread, so that errors in
+    // the TLS options are reported here.
+    tlsContext();
+    ws_websocketpp::uri parsedUri(uri);
+    std::string sessionKey = parsedUri.get_host() + ":" + parsedUri.get_port_str();
+    client->set_tls_init_handler(bind(&tlsInitHandler));
+    client->set_socket_init_handler(bind(&tlsInitSocket, sessionKey, parsedUri.get_host(), ::_2));
 
   } else {
     cpp11::stop("Invalid websocket URI: must begin with ws:// or wss://");
@@ -81,13 +149,24 @@ WebsocketConnection::WebsocketConnection(
     client->clear_error_channels(ws_websocketpp::log::elevel::all);
     client->update_log_channels("error", "set", errorLogChannels);
   }
-  client->init_asio();
-  client->set_open_handler(   bind(&WebsocketConnection::handleOpen,    this, ::_1));
-  client->set_message_handler(bind(&WebsocketConnection::handleMessage, this, ::_1, ::_2));
-  client->set_close_handler(  bind(&WebsocketConnection::handleClose,   this, ::_1));
-  client->set_fail_handler(   bind(&WebsocketConnection::handleFail,    this, ::_1));
-
+  if (sharedIo) {
+    client->init_asio(&IoPool::instance().acquire(ioThreads));
+  } else {
+    client->init_asio();
+  }
+  client->set_resolve_cache(&DnsCache::instance());
   client->set_max_message_size(maxMessageSize);
+}
+
+// This is separate from the constructor because the handlers need
+// shared_from_this(). The endpoint's handlers are copied into each
+// connection it creates, so they're set before setup_connection().
+void WebsocketConnection::setupConnection(cpp11::list compression) {
+  ASSERT_MAIN_THREAD()
+  client->set_open_handler(   handler(&WebsocketConnection::handleOpen));
+  client->set_message_handler(handler(&WebsocketConnection::handleMessage));
+  client->set_close_handler(  handler(&WebsocketConnection::handleClose));
+  client->set_fail_handler(   handler(&WebsocketConnection::handleFail));
 
   ws_websocketpp::lib::error_code ec;
   client->setup_connection(uri, ec);
@@ -95,51 +174,489 @@ WebsocketConnection::WebsocketConnection(
     // TODO Should we call onFail here?
     cpp11::stop("Could not create connection because: " + ec.message());
   }
+  client->set_write_complete_handler(handler(&WebsocketConnection::handleWriteComplete));
+  client->set_read_complete_handler(handler(&WebsocketConnection::handleReadComplete));
+  if (compression.size() > 0) {
+    client->append_header("Sec-WebSocket-Extensions", deflateOffer(compression));
+  }
+}
+
+WebsocketConnection::~WebsocketConnection() {
+  // Count the messages that were read but never passed to R, so that they
+  // don't stay in ioStats()$backlogMessages.
+  if (backlogMessages > 0) {
+    stats.discarded(backlogMessages);
+  }
+}
+
+void WebsocketConnection::deleteOnMainThread(WebsocketConnection* wsc) {
+  if (std::this_thread::get_id() == wsc->mainThread) {
+    delete wsc;
+    return;
+  }
+  // The last reference was held by a handler on a background thread. The
+  // object holds R objects, so it has to be deleted on the main thread.
+  later::later(
+    invoke_function_callback,
+    new function<void (void)>([wsc]() { delete wsc; }),
+    0
+  );
 }
 
 void WebsocketConnection::handleMessage(ws_websocketpp::connection_hdl, message_ptr msg) {
   ASSERT_BACKGROUND_THREAD()
+  StatsClock::time_point received = StatsClock::now();
+  stats.messagesIn(1, msg->get_payload().size());
+  bool stream = streamChunkSize > 0;
+  bool first = chunkFirst;
+  if (stream) {
+    chunkFirst = msg->get_fin();
+  }
+
+  MessageFilter::rule_ptr route;
+  if (!stream) {
+    route = filter.match(msg->get_payload());
+    if (route && route->drop) {
+      stats.filtered(1);
+      return;
+    }
+  }
+
+  shared_ptr<JsonDocument> json;
+  if (parseJson && !stream && msg->get_opcode() == ws_websocketpp::frame::opcode::value::text) {
+    json = make_shared<JsonDocument>();
+    const std::string& payload = msg->get_payload();
+    json->parse(payload.data(), payload.size());
+  }
+
+  std::string key;
+  bool keyed = conflationKey && !stream && !route &&
+    conflationKey->extract(msg->get_payload(), &key);
+
+  bool schedule = true;
+  bool replaced = false;
+  bool pause;
+  {
+    lock_guard<mutex> lock(pendingMutex);
+    if (keyed) {
+      std::pair<std::unordered_map<std::string, size_t>::iterator, bool> inserted =
+        pendingKeys.insert(std::make_pair(key, pendingMessages.size()));
+      if (!inserted.second) {
+        // Replace the older message with this key. A drain is already
+        // scheduled, since the older message is still pending.
+        size_t i = inserted.first->second;
+        backlogMessages--;
+        backlogBytes -= pendingMessages[i]->get_payload().size();
+        pendingMessages[i] = msg;
+        pendingTimes[i] = received;
+        pendingJson[i] = json;
+        replaced = true;
+        schedule = false;
+      }
+    }
+    if (batchMessages && !stream && !route && !replaced) {
+      // Queue the message, and schedule a drain only if one isn't already
+      // pending. The pending drain will pick up this message too.
+      pendingMessages.push_back(msg);
+      pendingTimes.push_back(received);
+      pendingJson.push_back(json);
+      if (conflationKey) {
+        pendingNames.push_back(key);
+      }
+      schedule = !drainScheduled;
+      drainScheduled = true;
+    }
+    backlogMessages++;
+    backlogBytes += msg->get_payload().size();
+    pause = (maxBacklogMessages > 0 && backlogMessages > maxBacklogMessages) ||
+            (maxBacklogBytes > 0 && backlogBytes > maxBacklogBytes);
+    if (pause) {
+      readPaused = true;
+    }
+  }
+  if (pause) {
+    // This is done for every message over the limit, not just the first, in
+    // case a resume from the main thread was already on its way.
+    client->pause_reading();
+  }
+  if (replaced) {
+    stats.conflated(1);
+  }
+  if (!schedule) {
+    return;
+  }
+
+  if (stream) {
+    // Message chunks are never batched, since each one may be large.
+    later::later(
+      invoke_function_callback,
+      new function<void (void)>(bind(&WebsocketConnection::rHandleMessageChunk, shared_from_this(), msg, first, received)),
+      0,
+      loop_id
+    );
+    return;
+  }
+
+  if (route) {
+    // Routed messages are never batched, so they may reach R ahead of
+    // earlier messages that are waiting in a batch.
+    later::later(
+      invoke_function_callback,
+      new function<void (void)>(bind(&WebsocketConnection::rHandleTopicMessage, shared_from_this(), msg, received, json, route->topic)),
+      0,
+      loop_id
+    );
+    return;
+  }
+
+  if (batchMessages) {
+    later::later(
+      invoke_function_callback,
+      new function<void (void)>(bind(&WebsocketConnection::rHandleMessages, shared_from_this())),
+      0,
+      loop_id
+    );
+    return;
+  }
+
   // Note that message_ptr is a shared_ptr, so the lifetime of msg will
   // continue until it's used by rHandleMessage().
   later::later(
     invoke_function_callback,
-    new function<void (void)>(bind(&WebsocketConnection::rHandleMessage, this, msg)),
+    new function<void (void)>(bind(&WebsocketConnection::rHandleMessage, shared_from_this(), msg, received, json)),
     0,
     loop_id
   );
 }
 
-void WebsocketConnection::rHandleMessage(message_ptr msg) {
+// Called on the main thread as messages are taken off the backlog, before
+// they're passed to R callbacks (which may throw). Resumes reading if it was
+// paused and the backlog is down to half of the limits.
+void WebsocketConnection::messagesDelivered(size_t n, size_t bytes) {
   ASSERT_MAIN_THREAD()
-  cpp11::writable::list event(2);
-  event[0] = robjPublic;
+  bool resume;
+  {
+    lock_guard<mutex> lock(pendingMutex);
+    backlogMessages -= n;
+    backlogBytes -= bytes;
+    resume = readPaused &&
+      (maxBacklogMessages == 0 || backlogMessages <= maxBacklogMessages / 2) &&
+      (maxBacklogBytes == 0 || backlogBytes <= maxBacklogBytes / 2);
+    if (resume) {
+      readPaused = false;
+    }
+  }
+  if (resume && (state == WebsocketConnection::STATE::OPEN ||
+                 state == WebsocketConnection::STATE::CLOSING))
+  {
+    client->resume_reading();
+  }
+}
+
+void WebsocketConnection::getBacklog(size_t* messages, size_t* bytes) {
+  lock_guard<mutex> lock(pendingMutex);
+  *messages = backlogMessages;
+  *bytes = backlogBytes;
+}
+
+void WebsocketConnection::handleReadComplete(ws_websocketpp::connection_hdl, size_t frames) {
+  ASSERT_BACKGROUND_THREAD()
+  stats.framesIn(frames);
+}
+
+void WebsocketConnection::setStreamChunkSize(size_t size) {
+  ASSERT_MAIN_THREAD()
+  streamChunkSize = size;
+  client->set_stream_chunk_size(size);
+}
+
+void WebsocketConnection::setKeepalive(long interval, long timeout) {
+  ASSERT_MAIN_THREAD()
+  client->set_pong_handler(handler(&WebsocketConnection::handlePong));
+  client->set_keepalive(interval, timeout);
+}
+
+// The payload of a keepalive ping is the time it was sent, in microseconds on
+// the steady clock. Pongs with any other payload (such as unsolicited pongs
+// from the server) are ignored.
+void WebsocketConnection::handlePong(ws_websocketpp::connection_hdl, std::string payload) {
+  ASSERT_BACKGROUND_THREAD()
+  if (payload.empty() || payload.find_first_not_of("0123456789") != std::string::npos) {
+    return;
+  }
+  long long sent = std::strtoll(payload.c_str(), NULL, 10);
+  long long now = std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()
+  ).count();
+  if (now < sent) {
+    return;
+  }
+  latency.add((now - sent) / 1000.0);
+}
+
+void WebsocketConnection::setReconnect(int maxAttempts, double initialDelay, double maxDelay) {
+  ASSERT_MAIN_THREAD()
+  reconnectMaxAttempts = maxAttempts;
+  reconnectInitialDelay = initialDelay;
+  reconnectMaxDelay = maxDelay;
+  reconnectRng.seed(std::random_device()());
+}
+
+// Whether to reconnect after the connection closes with this code, or after
+// a reconnect attempt fails (in which case the code is ignored).
+bool WebsocketConnection::shouldReconnect(ws_websocketpp::close::status::value code) {
+  ASSERT_MAIN_THREAD()
+  if (reconnectMaxDelay == 0 || closeOnOpen) {
+    return false;
+  }
+  if (reconnectMaxAttempts > 0 && reconnectAttempts >= reconnectMaxAttempts) {
+    return false;
+  }
+  if (reconnectAttempts > 0) {
+    return true;
+  }
+  // The connection was open. If close() was called, the state is CLOSING.
+  return state == WebsocketConnection::STATE::OPEN &&
+    code != ws_websocketpp::close::status::normal;
+}
+
+void WebsocketConnection::scheduleReconnect() {
+  ASSERT_MAIN_THREAD()
+  state = WebsocketConnection::STATE::INIT;
+  reconnectAttempts++;
+
+  // Equal jitter: wait between half of and all of the backoff delay, so that
+  // many clients that lost the same server don't all come back at once.
+  double delay = reconnectInitialDelay * std::pow(2.0, reconnectAttempts - 1);
+  delay = std::min(delay, reconnectMaxDelay);
+  delay *= std::uniform_real_distribution<double>(0.5, 1.0)(reconnectRng);
+
+  later::later(
+    invoke_function_callback,
+    new function<void (void)>(bind(&WebsocketConnection::rReconnect, shared_from_this())),
+    delay / 1000.0,
+    loop_id
+  );
+}
+
+void WebsocketConnection::rReconnect() {
+  ASSERT_MAIN_THREAD()
+  if (closeOnOpen) {
+    // close() was called while waiting.
+    rHandleClose(reconnectCloseCode, reconnectCloseReason);
+    return;
+  }
+
+  // State from the old connection that doesn't carry over. Nothing is
+  // running on the background thread for this connection at this point.
+  chunkFirst = true;
+  discardUnsent();
+  {
+    lock_guard<mutex> lock(pendingMutex);
+    readPaused = false;
+  }
+
+  // Hold on to the io_service work only until the new connection has queued
+  // its own; after that, reconnectWork may be set again by a failure.
+  shared_ptr<ws_websocketpp::lib::asio::io_service::work> work;
+  work.swap(reconnectWork);
+
+  ws_websocketpp::lib::error_code ec;
+  client->reconnect(ec);
+  if (ec) {
+    if (shouldReconnect(reconnectCloseCode)) {
+      reconnectWork.swap(work);
+      scheduleReconnect();
+    } else {
+      rHandleClose(reconnectCloseCode, reconnectCloseReason);
+    }
+  }
+}
+
+void WebsocketConnection::setMaxBacklog(size_t messages, size_t bytes) {
+  ASSERT_MAIN_THREAD()
+  lock_guard<mutex> lock(pendingMutex);
+  maxBacklogMessages = messages;
+  maxBacklogBytes = bytes;
+}
+
+void WebsocketConnection::setRawTextSize(size_t size) {
+  ASSERT_MAIN_THREAD()
+  rawTextSize = size;
+}
+
+void WebsocketConnection::setParseJson(bool simplifyVector) {
+  ASSERT_MAIN_THREAD()
+  parseJson = true;
+  simplifyJson = simplifyVector;
+}
+
+void WebsocketConnection::setConflation(shared_ptr<const ConflationKey> key) {
+  ASSERT_MAIN_THREAD()
+  conflationKey = key;
+  // Only messages waiting in a batch can be replaced.
+  batchMessages = true;
+}
+
+void WebsocketConnection::setCapture(shared_ptr<CaptureWriter> writer) {
+  ASSERT_MAIN_THREAD()
+  capture = writer;
+  client->set_read_data_handler(handler(&WebsocketConnection::handleReadData));
+}
+
+void WebsocketConnection::handleReadData(ws_websocketpp::connection_hdl, char const* buf, size_t len) {
+  ASSERT_BACKGROUND_THREAD()
+  capture->data(buf, len);
+}
+
+// Convert the payload of a message to an R object: a one-element character
+// vector for text messages, and a raw vector for binary messages and for
+// text messages of at least rawTextSize bytes. If the message was parsed as
+// JSON, the result is the parsed value instead; if it failed to parse, it's
+// the text, with the parse error in a "jsonError" attribute.
+static cpp11::sexp messageData(message_ptr msg, size_t rawTextSize,
+                               const shared_ptr<JsonDocument>& json, bool simplifyJson) {
+  ASSERT_MAIN_THREAD()
+  if (json) {
+    if (json->error().empty()) {
+      return jsonToR(*json, simplifyJson);
+    }
+    cpp11::sexp text = cpp11::as_sexp(msg->get_payload());
+    cpp11::safe[Rf_setAttrib](text, cpp11::safe[Rf_install]("jsonError"), cpp11::as_sexp(json->error()));
+    return text;
+  }
 
   ws_websocketpp::frame::opcode::value opcode = msg->get_opcode();
-  if (opcode == ws_websocketpp::frame::opcode::value::text) {
-    event[1] = cpp11::as_sexp(msg->get_payload());
+  if (opcode == ws_websocketpp::frame::opcode::value::text &&
+      msg->get_payload().size() < rawTextSize) {
+    return cpp11::as_sexp(msg->get_payload());
 
-  } else if (opcode == ws_websocketpp::frame::opcode::value::binary) {
-    const std::string msg_str = msg->get_payload();
-    event[1] = to_raw(msg_str);
-    //const uint8_t* msg_data = reinterpret_cast<const uint8_t*>(msg_str.c_str());
-    //event["data"] = cpp11::raws(*msg_data);
+  } else if (opcode == ws_websocketpp::frame::opcode::value::text ||
+             opcode == ws_websocketpp::frame::opcode::value::binary) {
+    // Copy straight out of the message buffer; get_payload() returns a
+    // reference, so there is no intermediate std::string.
+    return to_raw(msg->get_payload());
 
   } else {
     cpp11::stop("Unknown opcode for message (not text or binary).");
   }
+}
+
+void WebsocketConnection::rHandleMessage(message_ptr msg, StatsClock::time_point received, shared_ptr<JsonDocument> json) {
+  ASSERT_MAIN_THREAD()
+  messagesDelivered(1, msg->get_payload().size());
+  stats.dispatched(microsSince(received));
+  cpp11::writable::list event(2);
+  event[0] = robjPublic;
+  event[1] = messageData(msg, rawTextSize, json, simplifyJson);
 
   event.names() = { "target", "data" };
-  getInvoker("message")(event);
+  invokeCallbacks("message", event);
+}
+
+void WebsocketConnection::rHandleTopicMessage(message_ptr msg, StatsClock::time_point received, shared_ptr<JsonDocument> json, std::string topic) {
+  ASSERT_MAIN_THREAD()
+  messagesDelivered(1, msg->get_payload().size());
+  stats.dispatched(microsSince(received));
+  cpp11::writable::list event(3);
+  event[0] = robjPublic;
+  event[1] = messageData(msg, rawTextSize, json, simplifyJson);
+  event[2] = cpp11::as_sexp(topic);
+
+  event.names() = { "target", "data", "topic" };
+  invokeCallbacks("topic:" + topic, event);
+}
+
+void WebsocketConnection::rHandleMessageChunk(message_ptr msg, bool first, StatsClock::time_point received) {
+  ASSERT_MAIN_THREAD()
+  messagesDelivered(1, msg->get_payload().size());
+  stats.dispatched(microsSince(received));
+  cpp11::writable::list event(4);
+  event[0] = robjPublic;
+  event[1] = messageData(msg, rawTextSize, shared_ptr<JsonDocument>(), false);
+  event[2] = cpp11::as_sexp(first);
+  event[3] = cpp11::as_sexp(msg->get_fin());
+
+  event.names() = { "target", "data", "first", "last" };
+  invokeCallbacks("messageChunk", event);
+}
+
+void WebsocketConnection::rHandleMessages() {
+  ASSERT_MAIN_THREAD()
+  std::vector<message_ptr> batch;
+  std::vector<StatsClock::time_point> times;
+  std::vector<shared_ptr<JsonDocument>> parsed;
+  std::vector<std::string> keys;
+  {
+    lock_guard<mutex> lock(pendingMutex);
+    batch.swap(pendingMessages);
+    times.swap(pendingTimes);
+    parsed.swap(pendingJson);
+    keys.swap(pendingNames);
+    pendingKeys.clear();
+    drainScheduled = false;
+  }
+  if (batch.empty()) {
+    return;
+  }
+  size_t bytes = 0;
+  for (size_t i = 0; i < batch.size(); i++) {
+    bytes += batch[i]->get_payload().size();
+    stats.dispatched(microsSince(times[i]));
+  }
+  messagesDelivered(batch.size(), bytes);
+
+  cpp11::writable::list data(batch.size());
+  for (size_t i = 0; i < batch.size(); i++) {
+    data[i] = messageData(batch[i], rawTextSize, parsed[i], simplifyJson);
+  }
+  if (conflationKey) {
+    data.names() = cpp11::as_sexp(keys);
+  }
+
+  cpp11::writable::list event(2);
+  event[0] = robjPublic;
+  event[1] = data;
+  event.names() = { "target", "data" };
+  invokeCallbacks("messages", event);
+
+  // Callbacks registered with onMessage() still get one call per message.
+  if (hasCallbacks("message")) {
+    cpp11::list onMessage = getCallbacks("message");
+    for (R_xlen_t i = 0; i < data.size(); i++) {
+      cpp11::writable::list msg_event(2);
+      msg_event[0] = robjPublic;
+      msg_event[1] = data[i];
+      msg_event.names() = { "target", "data" };
+      invokeCallbacks(onMessage, msg_event);
+    }
+  }
 }
 
 void WebsocketConnection::handleClose(ws_websocketpp::connection_hdl) {
   ASSERT_BACKGROUND_THREAD()
+  if (capture) {
+    capture->flush();
+  }
+  if (reconnectMaxDelay > 0 && !sharedIo) {
+    reconnectWork = make_shared<ws_websocketpp::lib::asio::io_service::work>(
+      ws_websocketpp::lib::ref(client->get_io_service())
+    );
+  }
   ws_websocketpp::close::status::value code = client->get_remote_close_code();
   std::string reason = client->get_remote_close_reason();
+  if (code == ws_websocketpp::close::status::abnormal_close && reason.empty()) {
+    // There was no close frame from the server, so report why the connection
+    // ended instead (for example, a keepalive ping that went unanswered).
+    ws_websocketpp::lib::error_code ec = client->get_ec();
+    if (ec) {
+      reason = ec.message();
+    }
+  }
 
   later::later(
     invoke_function_callback,
-    new function<void (void)>(bind(&WebsocketConnection::rHandleClose, this, code, reason)),
+    new function<void (void)>(bind(&WebsocketConnection::rHandleClose, shared_from_this(), code, reason)),
     0,
     loop_id
   );
@@ -147,6 +664,22 @@ void WebsocketConnection::handleClose(ws_websocketpp::connection_hdl) {
 
 void WebsocketConnection::rHandleClose(ws_websocketpp::close::status::value code, std::string reason) {
   ASSERT_MAIN_THREAD()
+  discardUnsent();
+  if (shouldReconnect(code)) {
+    if (reconnectAttempts == 0) {
+      reconnectCloseCode = code;
+      reconnectCloseReason = reason;
+    }
+    scheduleReconnect();
+    return;
+  }
+  reconnectWork.reset();
+  reconnectAttempts = 0;
+
+  // Release the self-reference (if any), but keep this object alive until
+  // the end of this function.
+  shared_ptr<WebsocketConnection> self;
+  self.swap(keepAlive);
   state = WebsocketConnection::STATE::CLOSED;
   cpp11::writable::list event = {
     robjPublic,
@@ -159,17 +692,20 @@ void WebsocketConnection::rHandleClose(ws_websocketpp::close::status::value code
     "reason"
   };
 
-  cpp11::function onClose = getInvoker("close");
+  cpp11::list onClose = getCallbacks("close");
   removeHandlers();
-  onClose(event);
+  invokeCallbacks(onClose, event);
 }
 
 
 void WebsocketConnection::handleOpen(ws_websocketpp::connection_hdl) {
   ASSERT_BACKGROUND_THREAD()
+  if (capture) {
+    capture->open(client->get_handshake_response());
+  }
   later::later(
     invoke_function_callback,
-    new function<void (void)>(bind(&WebsocketConnection::rHandleOpen, this)),
+    new function<void (void)>(bind(&WebsocketConnection::rHandleOpen, shared_from_this())),
     0,
     loop_id
   );
@@ -184,17 +720,51 @@ void WebsocketConnection::rHandleOpen() {
   }
   state = WebsocketConnection::STATE::OPEN;
 
+  if (reconnectAttempts > 0) {
+    int attempts = reconnectAttempts;
+    reconnectAttempts = 0;
+    stats.reconnect();
+
+    cpp11::writable::list event = {
+      robjPublic,
+      cpp11::as_sexp(attempts)
+    };
+    event.names() = { "target", "attempts" };
+    invokeCallbacks("reconnect", event);
+
+    // Anything that was waiting to be written went with the old connection,
+    // so a sender waiting for onDrain can go ahead.
+    bool drained;
+    {
+      lock_guard<mutex> lock(waterMarkMutex);
+      drained = aboveHighWaterMark;
+      aboveHighWaterMark = false;
+    }
+    if (drained) {
+      rHandleDrain();
+    }
+    return;
+  }
+
   cpp11::writable::list event = { robjPublic };
   event.names() = { "target" };
-  getInvoker("open")(event);
+  invokeCallbacks("open", event);
 }
 
 
 void WebsocketConnection::handleFail(ws_websocketpp::connection_hdl) {
   ASSERT_BACKGROUND_THREAD()
+  if (capture) {
+    capture->flush();
+  }
+  if (reconnectMaxDelay > 0 && !sharedIo) {
+    reconnectWork = make_shared<ws_websocketpp::lib::asio::io_service::work>(
+      ws_websocketpp::lib::ref(client->get_io_service())
+    );
+  }
   later::later(
     invoke_function_callback,
-    new function<void (void)>(bind(&WebsocketConnection::rHandleFail, this)),
+    new function<void (void)>(bind(&WebsocketConnection::rHandleFail, shared_from_this())),
     0,
     loop_id
   );
@@ -202,6 +772,21 @@ void WebsocketConnection::handleFail(ws_websocketpp::connection_hdl) {
 
 void WebsocketConnection::rHandleFail() {
   ASSERT_MAIN_THREAD()
+  discardUnsent();
+  if (reconnectAttempts > 0) {
+    // A reconnect attempt failed. If there are no more tries, report the
+    // close that started it all.
+    if (shouldReconnect(reconnectCloseCode)) {
+      scheduleReconnect();
+    } else {
+      rHandleClose(reconnectCloseCode, reconnectCloseReason);
+    }
+    return;
+  }
+  reconnectWork.reset();
+
+  shared_ptr<WebsocketConnection> self;
+  self.swap(keepAlive);
   state = WebsocketConnection::STATE::FAILED;
 
   ws_websocketpp::lib::error_code ec = client->get_ec();
@@ -216,9 +801,68 @@ void WebsocketConnection::rHandleFail() {
     "message"
   };
 
-  cpp11::function onFail = getInvoker("error");
+  cpp11::list onFail = getCallbacks("error");
   removeHandlers();
-  onFail(event);
+  invokeCallbacks(onFail, event);
+}
+
+void WebsocketConnection::handleWriteComplete(
+  ws_websocketpp::connection_hdl,
+  size_t frames,
+  size_t dataFrames
+) {
+  ASSERT_BACKGROUND_THREAD()
+  stats.framesOut(frames, dataFrames);
+  sendTimes.written(dataFrames, stats);
+  {
+    lock_guard<mutex> lock(waterMarkMutex);
+    if (!aboveHighWaterMark || client->get_buffered_amount() > lowWaterMark) {
+      return;
+    }
+    aboveHighWaterMark = false;
+  }
+
+  later::later(
+    invoke_function_callback,
+    new function<void (void)>(bind(&WebsocketConnection::rHandleDrain, shared_from_this())),
+    0,
+    loop_id
+  );
+}
+
+void WebsocketConnection::rHandleDrain() {
+  ASSERT_MAIN_THREAD()
+  // The connection may have closed after the drain was scheduled, in which
+  // case the handlers have already been removed.
+  if (state == WebsocketConnection::STATE::CLOSED ||
+      state == WebsocketConnection::STATE::FAILED)
+  {
+    return;
+  }
+
+  cpp11::writable::list event = { robjPublic };
+  event.names() = { "target" };
+  invokeCallbacks("drain", event);
+}
+
+void WebsocketConnection::setWaterMarks(size_t high, size_t low) {
+  ASSERT_MAIN_THREAD()
+  lock_guard<mutex> lock(waterMarkMutex);
+  highWaterMark = high;
+  lowWaterMark = low;
+}
+
+bool WebsocketConnection::checkWaterMarks() {
+  ASSERT_MAIN_THREAD()
+  // The buffered amount is read with waterMarkMutex held, so that a write that
+  // completes on the background thread either sees aboveHighWaterMark, or
+  // finished before the amount was read here.
+  lock_guard<mutex> lock(waterMarkMutex);
+  if (client->get_buffered_amount() <= highWaterMark) {
+    return true;
+  }
+  aboveHighWaterMark = true;
+  return false;
 }
 
 void WebsocketConnection::close(uint16_t code, std::string reason) {
@@ -239,6 +883,14 @@ void WebsocketConnection::close(uint16_t code, std::string reason) {
   client->close(code, reason);
 }
 
+void WebsocketConnection::discardUnsent() {
+  ASSERT_MAIN_THREAD()
+  uint64_t n = sendTimes.clear();
+  if (n > 0) {
+    stats.unsent(n);
+  }
+}
+
 void WebsocketConnection::removeHandlers() {
   ASSERT_MAIN_THREAD()
   // Clear the references to the parts of the WebSocket R6 object. This is
@@ -247,11 +899,54 @@ void WebsocketConnection::removeHandlers() {
   cpp11::environment emptyenv = cpp11::environment(emptyenv_fn());
   robjPublic  = emptyenv;
   robjPrivate = emptyenv;
+  callbackCache.clear();
+  callbackInvoker = R_NilValue;
+}
+
+void WebsocketConnection::callbacksChanged(const std::string& name) {
+  ASSERT_MAIN_THREAD()
+  callbackCache.erase(name);
 }
 
-cpp11::function WebsocketConnection::getInvoker(std::string name) {
+cpp11::list WebsocketConnection::getCallbacks(const std::string& name) {
   ASSERT_MAIN_THREAD()
-  cpp11::function get_invoker(robjPrivate["getInvoker"]);
-  cpp11::function invoker(get_invoker(name));
-  return invoker;
+  std::map<std::string, cpp11::list>::iterator it = callbackCache.find(name);
+  if (it != callbackCache.end()) {
+    return it->second;
+  }
+  cpp11::function get_callbacks(robjPrivate["getCallbacks"]);
+  cpp11::list result(get_callbacks(name));
+  callbackCache.insert(std::make_pair(name, result));
+  return result;
+}
+
+bool WebsocketConnection::hasCallbacks(const std::string& name) {
+  ASSERT_MAIN_THREAD()
+  return getCallbacks(name).size() > 0;
+}
+
+void WebsocketConnection::invokeCallbacks(cpp11::list callbacks, SEXP event) {
+  ASSERT_MAIN_THREAD()
+  if (callbacks.size() == 0) {
+    return;
+  }
+  cpp11::sexp invoker = callbackInvoker;
+  if (invoker == R_NilValue) {
+    invoker = cpp11::package("websocket")["invokeCallback"];
+    // The onClose and onError callbacks run after removeHandlers(), and the
+    // function shouldn't be cached again by them.
+    if (state != WebsocketConnection::STATE::CLOSED &&
+        state != WebsocketConnection::STATE::FAILED)
+    {
+      callbackInvoker = invoker;
+    }
+  }
+  cpp11::function invoke(invoker);
+  for (R_xlen_t i = 0; i < callbacks.size(); i++) {
+    invoke(callbacks[i], event);
+  }
+}
+
+void WebsocketConnection::invokeCallbacks(const std::string& name, SEXP event) {
+  invokeCallbacks(getCallbacks(name), event);
 }
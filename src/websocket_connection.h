@@ -2,8 +2,19 @@
 #define WEBSOCKET_CONNECTION_HPP
 
 #include <later_api.h>
+#include <limits>
+#include <map>
+#include <unordered_map>
+#include <random>
+#include <thread>
+#include <vector>
 #include "cpp11.hpp"
 #include "websocket_defs.h"
+#include "capture.h"
+#include "filter.h"
+#include "json.h"
+#include "latency.h"
+#include "stats.h"
 
 
 class WebsocketConnection : public enable_shared_from_this<WebsocketConnection>
@@ -16,40 +27,218 @@ public:
     cpp11::environment robjPrivate,
     cpp11::strings accessLogChannels,
     cpp11::strings errorLogChannels,
-    int maxMessageSize
+    int maxMessageSize,
+    bool batchMessages,
+    bool sharedIo,
+    int ioThreads,
+    cpp11::list compression,
+    cpp11::list replay
   );
 
+  // Set the handlers and create the connection. Call this once, right after
+  // the object is owned by a shared_ptr.
+  void setupConnection(cpp11::list compression);
+
+  // The deleter for the shared_ptr that owns the object.
+  static void deleteOnMainThread(WebsocketConnection* wsc);
+
   // Make noncopyable (without boost)
   WebsocketConnection(const WebsocketConnection&) = delete;
   WebsocketConnection& operator=(const WebsocketConnection&) = delete;
 
 
-  void rHandleMessage(message_ptr msg);
+  void rHandleMessage(message_ptr msg, StatsClock::time_point received, shared_ptr<JsonDocument> json);
+  void rHandleTopicMessage(message_ptr msg, StatsClock::time_point received, shared_ptr<JsonDocument> json, std::string topic);
+  void rHandleMessages();
+  void rHandleMessageChunk(message_ptr msg, bool first, StatsClock::time_point received);
   void rHandleClose(ws_websocketpp::close::status::value code, std::string reason);
   void rHandleOpen();
   void rHandleFail();
+  void rHandleDrain();
+  void rReconnect();
 
   shared_ptr<Client> client;
 
   void close(uint16_t code, std::string reason);
 
+  void setWaterMarks(size_t high, size_t low);
+  void setMaxBacklog(size_t messages, size_t bytes);
+  void setStreamChunkSize(size_t size);
+  void setKeepalive(long interval, long timeout);
+  void setReconnect(int maxAttempts, double initialDelay, double maxDelay);
+  void setRawTextSize(size_t size);
+  void setParseJson(bool simplifyVector);
+  void setConflation(shared_ptr<const ConflationKey> key);
+  void setCapture(shared_ptr<CaptureWriter> writer);
+
+  // Call when callbacks for an event are registered or removed, so that the
+  // cached list is fetched again before the next event.
+  void callbacksChanged(const std::string& name);
+
+  // Round trip times from keepalive pings.
+  LatencyStats latency;
+  // Message and frame counters. These are also added to globalStats().
+  ConnectionStats stats;
+  // Send times of queued messages, for stats.writeLatency.
+  SendTimes sendTimes;
+  // Rules that drop incoming messages, or route them to the callbacks for a
+  // topic, on the background thread. Messages that arrive in parts (see
+  // streamChunkSize) are not filtered.
+  MessageFilter filter;
+  // The number of messages and bytes that have arrived but not yet been
+  // passed to R.
+  void getBacklog(size_t* messages, size_t* bytes);
+
+  // Call after queueing messages. Returns false if the amount of buffered
+  // data is above the high water mark, in which case a drain event will be
+  // sent once it falls to the low water mark.
+  bool checkWaterMarks();
+
   enum STATE { INIT, OPEN, CLOSING, CLOSED, FAILED };
   // This value should be touched only from the main thread.
   STATE state = INIT;
 
-  // ~WebsocketConnection() {
-  //   std::cerr << "WebsocketConnection::~WebsocketConnection\n";
-  // };
+  // If true, the connection's I/O runs on the shared IoPool instead of on its
+  // own WebsocketTask thread.
+  bool sharedIo;
+  // With sharedIo, there is no WebsocketTask holding a reference to this
+  // object while the connection is active, so the object holds one to itself.
+  // It is set when connecting and released after the close or fail event.
+  // After that, handlers that are still running, and callbacks they have
+  // scheduled, hold their own references (see handler()). This value should
+  // be touched only from the main thread.
+  shared_ptr<WebsocketConnection> keepAlive;
+
+  // Counts any messages still in the backlog as discarded.
+  ~WebsocketConnection();
 
 private:
   std::string uri;
   int loop_id;
   cpp11::environment robjPublic;
   cpp11::environment robjPrivate;
+  std::thread::id mainThread;
+
+  // Returns a handler for the Client that calls `method`. The handler keeps
+  // only a weak reference to this object, and holds a strong one while it
+  // runs, so that the object can't be deleted under a handler that is
+  // running on the background thread. (With sharedIo, nothing on the
+  // background side owns the object once keepAlive is released.) If the
+  // object is gone, the handler does nothing.
+  template <typename... Args>
+  ws_websocketpp::lib::function<void(Args...)> handler(void (WebsocketConnection::*method)(Args...)) {
+    weak_ptr<WebsocketConnection> weak = shared_from_this();
+    return [weak, method](Args... args) {
+      shared_ptr<WebsocketConnection> self = weak.lock();
+      if (self) {
+        ((*self).*method)(args...);
+      }
+    };
+  }
 
   // This value should be touched only from the main thread.
   bool closeOnOpen = false;
 
+  // Automatic reconnection. When reconnectMaxDelay is nonzero and an open
+  // connection is closed by anything other than close() or a normal close
+  // from the server, the Client replaces it with a new connection after a
+  // delay that doubles with each failed attempt, starting at
+  // reconnectInitialDelay and capped at reconnectMaxDelay (in milliseconds),
+  // with random jitter. A maxAttempts of 0 means no limit. These settings
+  // must be set before connecting; the rest of the values are touched only
+  // from the main thread, except for reconnectWork.
+  int reconnectMaxAttempts = 0;
+  double reconnectInitialDelay = 0;
+  double reconnectMaxDelay = 0;
+  int reconnectAttempts = 0;
+  std::mt19937 reconnectRng;
+  // The code and reason from the close that started reconnecting, which are
+  // reported to onClose if reconnecting fails.
+  ws_websocketpp::close::status::value reconnectCloseCode;
+  std::string reconnectCloseReason;
+  // Keeps the connection's own io_service (and so its WebsocketTask thread)
+  // running between the old connection closing and the new one starting. It
+  // is set on the background thread before rHandleClose() or rHandleFail()
+  // is scheduled, and released on the main thread.
+  shared_ptr<ws_websocketpp::lib::asio::io_service::work> reconnectWork;
+  bool shouldReconnect(ws_websocketpp::close::status::value code);
+  void scheduleReconnect();
+
+  // When batchMessages is true, incoming messages are collected in
+  // pendingMessages on the background thread, and at most one later callback
+  // at a time is scheduled to hand them all to R. pendingMessages and
+  // drainScheduled are protected by pendingMutex.
+  bool batchMessages;
+  mutex pendingMutex;
+  std::vector<message_ptr> pendingMessages;
+  // The time each of pendingMessages was read.
+  std::vector<StatsClock::time_point> pendingTimes;
+  // The parsed form of each of pendingMessages, when parseJson is true.
+  std::vector<shared_ptr<JsonDocument>> pendingJson;
+  bool drainScheduled = false;
+
+  // Last-value conflation. When conflationKey is set, batching is on, and a
+  // message whose key is already in pendingKeys replaces the pending message
+  // with that key, in place, instead of being added to the batch; so the
+  // batch holds at most one message per key, and R only sees the newest. The
+  // key of each of pendingMessages ("" for messages with no key) is kept in
+  // pendingNames, to name the batch's elements. pendingKeys and pendingNames
+  // are also protected by pendingMutex. conflationKey must be set before
+  // connecting.
+  shared_ptr<const ConflationKey> conflationKey;
+  std::unordered_map<std::string, size_t> pendingKeys;
+  std::vector<std::string> pendingNames;
+
+  // When set, the handshake response and every read from the socket are
+  // appended to a capture file on the background thread, for replaying
+  // later (see ReplayClient). It must be set before connecting.
+  shared_ptr<CaptureWriter> capture;
+
+  // When streamChunkSize is nonzero, data messages arrive from the Client in
+  // parts, and are passed to R as messageChunk events instead of message
+  // events. chunkFirst is true if the next part is the first of a message;
+  // it's touched only on the background thread. streamChunkSize must be set
+  // before connecting.
+  size_t streamChunkSize = 0;
+  bool chunkFirst = true;
+
+  // Text messages of at least rawTextSize bytes are passed to R as raw
+  // vectors, like binary messages. Making a string would hash the whole
+  // payload and add it to R's global string cache, which is wasted work for
+  // large messages that are only parsed once. This value should be touched
+  // only from the main thread.
+  size_t rawTextSize = std::numeric_limits<size_t>::max();
+
+  // When parseJson is true, text messages are parsed as JSON on the
+  // background thread, in handleMessage(), and only converted to R objects
+  // on the main thread. It must be set before connecting. Messages that
+  // arrive in parts (see streamChunkSize) are not parsed.
+  bool parseJson = false;
+  bool simplifyJson = true;
+
+  // Receive flow control. backlogMessages and backlogBytes count messages
+  // that have arrived but have not yet been handed to R. When either goes
+  // over its limit, reading from the socket is paused, so that TCP pushes
+  // back on the server; it resumes once R has worked the backlog down to
+  // half of the limits. A limit of 0 means no limit. These values are also
+  // protected by pendingMutex.
+  size_t maxBacklogMessages = 0;
+  size_t maxBacklogBytes = 0;
+  size_t backlogMessages = 0;
+  size_t backlogBytes = 0;
+  bool readPaused = false;
+  void messagesDelivered(size_t n, size_t bytes);
+
+  // Send backpressure. When checkWaterMarks() finds more than highWaterMark
+  // bytes buffered, it sets aboveHighWaterMark. After each completed write,
+  // handleWriteComplete() checks whether the buffered amount has fallen to
+  // lowWaterMark, and if so, clears the flag and schedules rHandleDrain().
+  // These values are protected by waterMarkMutex.
+  mutex waterMarkMutex;
+  size_t highWaterMark = 16 * 1024 * 1024;
+  size_t lowWaterMark = 4 * 1024 * 1024;
+  bool aboveHighWaterMark = false;
+
   // Callbacks for the Client object - these run on the background thread, and
   // schedule their counterparts prefixed with "r" (like rHandleMessage()) to
   // run on the main R thread.
@@ -57,10 +246,30 @@ private:
   void handleClose(ws_websocketpp::connection_hdl);
   void handleOpen(ws_websocketpp::connection_hdl);
   void handleFail(ws_websocketpp::connection_hdl);
+  void handleWriteComplete(ws_websocketpp::connection_hdl, size_t frames, size_t dataFrames);
+  void handleReadComplete(ws_websocketpp::connection_hdl, size_t frames);
+  void handleReadData(ws_websocketpp::connection_hdl, char const* buf, size_t len);
+  void handlePong(ws_websocketpp::connection_hdl, std::string payload);
 
   void removeHandlers();
+  // Call on the main thread when the connection has ended, to count the
+  // messages that were sent but never written.
+  void discardUnsent();
 
-  cpp11::function getInvoker(std::string name);
+  // The callbacks registered for each event, in the order they were
+  // registered. Each list is fetched from R the first time it's needed and
+  // then reused until callbacksChanged() is called, so that dispatching an
+  // event doesn't have to call into the R6 object.
+  std::map<std::string, cpp11::list> callbackCache;
+  cpp11::list getCallbacks(const std::string& name);
+  bool hasCallbacks(const std::string& name);
+  // Call each callback with the event, through the package's
+  // invokeCallback(), so that an error in one callback is reported and
+  // doesn't stop the rest from being called. The function is cached in
+  // callbackInvoker until removeHandlers() is called.
+  cpp11::sexp callbackInvoker;
+  void invokeCallbacks(cpp11::list callbacks, SEXP event);
+  void invokeCallbacks(const std::string& name, SEXP event);
 };
 
 #endif
@@ -4,6 +4,7 @@
 #include "client.hpp"
 #include "wrapped_print.h"
 #include <websocketpp/common/functional.hpp>
+#include <websocketpp/common/thread.hpp>
 
 // The websocketpp/common/functional.hpp file detects if a C++11 compiler is
 // used. If so, ws_websocketpp::lib::shared_ptr is a std::shared_ptr. If not,
@@ -13,8 +14,12 @@ using ws_websocketpp::lib::weak_ptr;
 using ws_websocketpp::lib::make_shared;
 using ws_websocketpp::lib::enable_shared_from_this;
 
+using ws_websocketpp::lib::mutex;
+using ws_websocketpp::lib::lock_guard;
+
 using ws_websocketpp::lib::placeholders::_1;
 using ws_websocketpp::lib::placeholders::_2;
+using ws_websocketpp::lib::placeholders::_3;
 using ws_websocketpp::lib::bind;
 
 typedef shared_ptr<asio::ssl::context> context_ptr;
@@ -0,0 +1,8 @@
+#include <zlib.h>
+
+int main(){
+  z_stream strm = {0};
+  deflateInit(&strm, Z_DEFAULT_COMPRESSION);
+  deflateEnd(&strm);
+  return 0;
+}